@@ -15,6 +15,17 @@ constexpr double dbl_resolution = 1e-8;
 constexpr unsigned int max_integrations = 100;
 constexpr double default_max_permitted_area_error = 0.01;
 constexpr double max_permitted_area_drift = 0.05;
+
+// With --fp32_spectral, switch to double precision if
+// fp32_spectral_max_stalls consecutive integrations do not reduce the maximum
+// area error below this fraction of its previous value
+constexpr double fp32_spectral_stall_ratio = 0.95;
+constexpr unsigned int fp32_spectral_max_stalls = 3;
+
+// With --incremental_quadtree, the quadtree is only revisited where the
+// blurred density has changed by more than this fraction of its range
+constexpr double incremental_quadtree_tolerance = 1e-3;
+
 constexpr double padding_unless_world = 1.5;
 constexpr double pi = std::numbers::pi;
 constexpr double earth_surface_area = 510.1e6;
@@ -0,0 +1,36 @@
+#ifndef COVERAGE_RASTER_HPP_
+#define COVERAGE_RASTER_HPP_
+
+#include "cgal_typedef.hpp"
+#include <vector>
+
+// Run of cells (x, y_begin) to (x, y_end - 1) that are covered by a
+// fraction `coverage` of a polygon with holes of GeoDiv gd_id
+struct CoverageSpan {
+  unsigned int x;
+  unsigned int y_begin;
+  unsigned int y_end;
+  unsigned int gd_id;
+  double coverage;
+};
+
+// Appends the exact coverage of each cell of the lx x ly grid by pwh to
+// `spans`. Cells that the boundary passes through get one span each. Runs
+// of cells that are entirely inside pwh are merged into one span with
+// coverage 1. Outer boundaries must be counter-clockwise and holes
+// clockwise.
+void rasterize_pwh_coverage(
+  const Polygon_with_holes &pwh,
+  unsigned int gd_id,
+  unsigned int lx,
+  unsigned int ly,
+  std::vector<CoverageSpan> &spans);
+
+// Area of the intersection of pwh with the rectangle, by clipping each ring
+// to the rectangle. It is much slower than rasterize_pwh_coverage() and
+// serves as a reference for it.
+double compute_pwh_rectangle_overlap_area(
+  const Polygon_with_holes &pwh,
+  const Bbox &rect_bbox);
+
+#endif  // COVERAGE_RASTER_HPP_
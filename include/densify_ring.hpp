@@ -0,0 +1,426 @@
+#ifndef DENSIFY_RING_HPP_
+#define DENSIFY_RING_HPP_
+
+#include "cgal_typedef.hpp"
+#include "round_point.hpp"
+#include <CGAL/intersections.h>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Densification of polygon rings at the edges of the quadtree triangulation,
+// by walking each segment through the quadtree leaves that it crosses
+namespace leaf_walk
+{
+// Edge classification of triangulation edges
+// We use fast-paths for common cases, avoiding expensive CGAL intersection
+// calls; This is particularly useful for our case because most of our edges
+// are axis-aligned or 45° diagonal, and we can handle them with simple
+// arithmetic.
+
+// H    (0): horizontal edge, y1 == y2
+// V    (1): vertical edge,   x1 == x2
+// DPOS (2): 45° diagonal with positive slope (|dx|==|dy| and dx*dy > 0)  ↗ / ↙
+// DNEG (3): 45° diagonal with negative slope (|dx|==|dy| and dx*dy < 0)  ↖ / ↘
+// OTHER(4): all other edges (non-axis-aligned, non-45°, or degenerate)
+enum class EdgeKind : uint8_t { H = 0, V = 1, DPOS = 2, DNEG = 3, OTHER = 4 };
+
+inline EdgeKind classify_edge(
+  const uint32_t x0,
+  const uint32_t y0,
+  const uint32_t x1,
+  const uint32_t y1)
+{
+  if (y0 == y1)
+    return EdgeKind::H;
+  if (x0 == x1)
+    return EdgeKind::V;
+
+  const int64_t dx = int64_t(x1) - int64_t(x0);
+  const int64_t dy = int64_t(y1) - int64_t(y0);
+
+  if (dy == dx)
+    return EdgeKind::DPOS;  // slope +1
+  if (dy == -dx)
+    return EdgeKind::DNEG;  // slope -1
+
+  return EdgeKind::OTHER;
+}
+
+// Crossing of the query segment with a triangulation edge, at parameter t
+// along the query
+using Hit = std::pair<double, Point>;
+
+// Add the intersections of the query segment [pt1, pt2] with the
+// triangulation edge E to `hits`. E must be oriented with its smaller vertex
+// (in (x, y) order) first, so that an edge shared by two leaves gives
+// bit-identical hits from either leaf.
+inline void add_edge_hits(
+  const Point &pt1,
+  const Point &pt2,
+  const Segment &E,
+  const EdgeKind kind,
+  std::vector<Hit> &hits)
+{
+  // Param t along [pt1, pt2] for ordering hits
+  const double ax = pt1.x(), ay = pt1.y();
+  const double bx = pt2.x(), by = pt2.y();
+  const double dax = bx - ax, day = by - ay;
+  const double L2 = dax * dax + day * day;
+
+  auto t_of = [&](const Point &p) -> double {
+    if (almost_equal(L2, 0.0))  // pt1 == pt2
+      return 0.0;
+    return ((p.x() - ax) * dax + (p.y() - ay) * day) / L2;
+  };
+
+  const double ex0 = E.source().x(), ey0 = E.source().y();
+  const double ex1 = E.target().x(), ey1 = E.target().y();
+
+  auto in_closed01 = [&](double t) {
+    return less_than_equal(0.0, t) && less_than_equal(t, 1.0);
+  };
+
+  auto within_closed = [&](double v, double a, double b) {
+    const double lo = std::min(a, b);
+    const double hi = std::max(a, b);
+    return less_than_equal(lo, v) && less_than_equal(v, hi);
+  };
+
+  // Here we use the edge classification to handle the most common cases
+  // with simple arithmetic, avoiding expensive CGAL intersection calls
+  switch (kind) {
+
+  case EdgeKind::H: {
+    const double y0 = ey0;  // == ey1
+    const double dy = day;  // query dy
+    if (almost_equal(dy, 0.0)) {
+      // Query horizontal: either collinear or disjoint
+      if (almost_equal(ay, y0)) {
+        // Collinear overlap: push both endpoints of edge (clipped to [0,1])
+        const Point p0(ex0, y0), p1(ex1, y0);
+        const double t0 = t_of(p0), t1 = t_of(p1);
+        if (in_closed01(t0))
+          hits.emplace_back(t0, p0);
+        if (in_closed01(t1))
+          hits.emplace_back(t1, p1);
+      }
+      // else disjoint: nothing to add
+    } else {
+      const double t = (y0 - ay) / dy;
+      if (!in_closed01(t)) {
+        // intersection with infinite line lies outside the segment
+      } else {
+        const double x = ax + t * dax;
+        if (within_closed(x, ex0, ex1))
+          hits.emplace_back(std::clamp(t, 0.0, 1.0), Point(x, y0));
+      }
+    }
+    break;
+  }
+
+  case EdgeKind::V: {
+    const double x0 = ex0;  // == ex1
+    const double dx = dax;  // query dx
+    if (almost_equal(dx, 0.0)) {
+      // Query vertical: collinear or disjoint
+      if (almost_equal(ax, x0)) {
+        const Point p0(x0, ey0), p1(x0, ey1);
+        const double t0 = t_of(p0), t1 = t_of(p1);
+        if (in_closed01(t0))
+          hits.emplace_back(t0, p0);
+        if (in_closed01(t1))
+          hits.emplace_back(t1, p1);
+      }
+    } else {
+      const double t = (x0 - ax) / dx;
+      if (!in_closed01(t)) {
+        // outside segment
+      } else {
+        const double y = ay + t * day;
+        if (within_closed(y, ey0, ey1))
+          hits.emplace_back(std::clamp(t, 0.0, 1.0), Point(x0, y));
+      }
+    }
+    break;
+  }
+
+  case EdgeKind::DPOS: {
+    // Edge: y - ey0 = +(x - ex0)  =>  y - x = c
+    const double c = ey0 - ex0;
+    const double denom = (day - dax);  // (qy - qx)
+    if (almost_equal(denom, 0.0)) {
+      // Query also slope +1; collinear iff same c
+      const double c_q = (ay - ax);
+      if (almost_equal(c_q, c)) {
+        const Point p0(ex0, ey0), p1(ex1, ey1);
+        const double t0 = t_of(p0), t1 = t_of(p1);
+        if (in_closed01(t0))
+          hits.emplace_back(t0, p0);
+        if (in_closed01(t1))
+          hits.emplace_back(t1, p1);
+      }
+    } else {
+      const double t = (c - (ay - ax)) / denom;
+      if (in_closed01(t)) {
+        const double x = ax + t * dax;
+        const double y = ay + t * day;
+        if (within_closed(x, ex0, ex1) && within_closed(y, ey0, ey1))
+          hits.emplace_back(std::clamp(t, 0.0, 1.0), Point(x, y));
+      }
+    }
+    break;
+  }
+
+  case EdgeKind::DNEG: {
+    // Edge: y - ey0 = -(x - ex0)  =>  y + x = c
+    const double c = ey0 + ex0;
+    const double denom = (day + dax);  // (qy + qx)
+    if (almost_equal(denom, 0.0)) {
+      const double c_q = (ay + ax);
+      if (almost_equal(c_q, c)) {
+        const Point p0(ex0, ey0), p1(ex1, ey1);
+        const double t0 = t_of(p0), t1 = t_of(p1);
+        if (in_closed01(t0))
+          hits.emplace_back(t0, p0);
+        if (in_closed01(t1))
+          hits.emplace_back(t1, p1);
+      }
+    } else {
+      const double t = (c - (ay + ax)) / denom;
+      if (in_closed01(t)) {
+        const double x = ax + t * dax;
+        const double y = ay + t * day;
+        if (within_closed(x, ex0, ex1) && within_closed(y, ey0, ey1))
+          hits.emplace_back(std::clamp(t, 0.0, 1.0), Point(x, y));
+      }
+    }
+    break;
+  }
+
+  case EdgeKind::OTHER: {
+    CGAL::Object obj = CGAL::intersection(Segment(pt1, pt2), E);
+    Point ip;
+    if (CGAL::assign(ip, obj)) {
+      const double t = t_of(ip);
+      if (in_closed01(t))
+        hits.emplace_back(t, ip);
+    } else {
+      Segment seg;
+      if (CGAL::assign(seg, obj)) {
+        const Point p0 = seg.source();
+        const Point p1 = seg.target();
+        const double t0 = t_of(p0);
+        const double t1 = t_of(p1);
+        if (in_closed01(t0))
+          hits.emplace_back(t0, p0);
+        if (in_closed01(t1))
+          hits.emplace_back(t1, p1);
+      }
+    }
+    break;
+  }
+  default:
+    // Should not happen
+    assert(false);
+    break;
+  }
+}
+
+// Walks the segment [pt1, pt2] through the quadtree leaves that it crosses
+// and collects its intersections with the edges of their triangles. The next
+// leaf is found from the side through which the segment leaves the current
+// one, so no search structure over all edges is needed. The hits are sorted
+// by t and unique, with pt1 first and pt2 last.
+template <class Locator, class Triang>
+void densification_points_by_leaf_walk(
+  const Point &pt1,
+  const Point &pt2,
+  const Locator &locator,
+  const Triang &triang,
+  const unsigned int lx,
+  const unsigned int ly,
+  std::vector<Hit> &hits)
+{
+  hits.clear();
+  hits.emplace_back(0.0, pt1);
+  hits.emplace_back(1.0, pt2);
+
+  const double dx = pt2.x() - pt1.x();
+  const double dy = pt2.y() - pt1.y();
+
+  // Cell in which the segment starts, taking cells on the far side of a grid
+  // line if the segment starts on the line and moves away from it
+  auto start_cell = [](double p, double d, unsigned int l) {
+    double c = std::floor(p);
+    if (d < 0.0 && c >= p) {
+      c -= 1.0;
+    }
+    return static_cast<uint32_t>(std::clamp(c, 0.0, double(l - 1)));
+  };
+  uint32_t cx = start_cell(pt1.x(), dx, lx);
+  uint32_t cy = start_cell(pt1.y(), dy, ly);
+
+  // A leaf has at most six triangles and thus 18 edges
+  std::array<std::array<uint32_t, 4>, 18> edges{};
+  while (true) {
+    const auto leaf = locator.locate(cx + 0.5, cy + 0.5);
+
+    // Intersections with the edges of the leaf's triangles. Each interior
+    // edge belongs to two triangles, so duplicates are removed first.
+    size_t n_edges = 0;
+    for (const auto &tri : triang.leaf_triangles(leaf.x, leaf.y)) {
+      for (size_t i = 0; i < 3; ++i) {
+        const auto &p = tri.vertices[i];
+        const auto &q = tri.vertices[(i + 1) % 3];
+        if (q.x() < p.x() || (q.x() == p.x() && q.y() < p.y())) {
+          edges[n_edges++] = {q.x(), q.y(), p.x(), p.y()};
+        } else {
+          edges[n_edges++] = {p.x(), p.y(), q.x(), q.y()};
+        }
+      }
+    }
+    std::sort(edges.begin(), edges.begin() + n_edges);
+    const auto edges_end =
+      std::unique(edges.begin(), edges.begin() + n_edges);
+    for (auto e = edges.begin(); e != edges_end; ++e) {
+      const auto &[x0, y0, x1, y1] = *e;
+      add_edge_hits(
+        pt1,
+        pt2,
+        Segment(Point(x0, y0), Point(x1, y1)),
+        classify_edge(x0, y0, x1, y1),
+        hits);
+    }
+
+    // Parameter at which the segment leaves the leaf through its vertical
+    // and horizontal sides
+    const double inf = std::numeric_limits<double>::infinity();
+    const double tx =
+      (dx > 0.0)   ? (leaf.x + leaf.size - pt1.x()) / dx
+      : (dx < 0.0) ? (leaf.x - pt1.x()) / dx
+                   : inf;
+    const double ty =
+      (dy > 0.0)   ? (leaf.y + leaf.size - pt1.y()) / dy
+      : (dy < 0.0) ? (leaf.y - pt1.y()) / dy
+                   : inf;
+    const double t_exit = std::min(tx, ty);
+    if (t_exit >= 1.0) {
+      break;
+    }
+
+    // First cell of the next leaf. Across the side that the segment leaves
+    // through, the cell is the neighbour of the leaf. Along that side, it is
+    // the cell of the exit point, limited to the leaf's range.
+    auto along = [t_exit](double p, double d, uint32_t lo, uint32_t size) {
+      const double c = std::floor(p + t_exit * d);
+      return static_cast<uint32_t>(
+        std::clamp(c, double(lo), double(lo + size - 1)));
+    };
+    const bool exit_x = (tx <= t_exit);
+    const bool exit_y = (ty <= t_exit);
+    if (exit_x) {
+      if (dx > 0.0 ? leaf.x + leaf.size >= lx : leaf.x == 0) {
+        break;
+      }
+      cx = (dx > 0.0) ? leaf.x + leaf.size : leaf.x - 1;
+    } else {
+      cx = along(pt1.x(), dx, leaf.x, leaf.size);
+    }
+    if (exit_y) {
+      if (dy > 0.0 ? leaf.y + leaf.size >= ly : leaf.y == 0) {
+        break;
+      }
+      cy = (dy > 0.0) ? leaf.y + leaf.size : leaf.y - 1;
+    } else {
+      cy = along(pt1.y(), dy, leaf.y, leaf.size);
+    }
+  }
+
+  // Sort by t and unique
+  std::sort(hits.begin(), hits.end(), [](auto const &a, auto const &b) {
+    return a.first < b.first;
+  });
+  hits.erase(
+    std::unique(
+      hits.begin(),
+      hits.end(),
+      [](auto const &a, auto const &b) {
+        return a.second == b.second;
+      }),
+    hits.end());
+}
+
+// Appends the densified segment [a, b] to `ring`, without b, which is the
+// first point of the next segment. Shared boundaries of neighbouring GeoDivs
+// are traversed in opposite directions, so each segment is walked from its
+// smaller endpoint. Both GeoDivs thus receive bit-identical points.
+template <class Locator, class Triang>
+void append_densified_segment(
+  const Point &a,
+  const Point &b,
+  const Locator &locator,
+  const Triang &triang,
+  const unsigned int lx,
+  const unsigned int ly,
+  std::vector<Hit> &hits,
+  Polygon &ring)
+{
+  // A zero-length edge adds no point. Its end is the start of the next
+  // segment.
+  if (a == b) {
+    return;
+  }
+  const bool reversed = b < a;
+  densification_points_by_leaf_walk(
+    reversed ? b : a,
+    reversed ? a : b,
+    locator,
+    triang,
+    lx,
+    ly,
+    hits);
+  if (hits.size() < 2) {
+    return;
+  }
+  if (reversed) {
+    for (size_t i = hits.size() - 1; i > 0; --i) {
+      ring.push_back(hits[i].second);
+    }
+  } else {
+    for (size_t i = 0; i + 1 < hits.size(); ++i) {
+      ring.push_back(hits[i].second);
+    }
+  }
+}
+
+// Densifies the closed ring `ring` into `ring_dens`. `locator` gives the
+// quadtree leaf at a point and `triang` the triangles of a leaf, as
+// QuadtreeLeafLocator and Triangulation do. `hits` is scratch space that can
+// be reused between calls.
+template <class Locator, class Triang>
+void densify_ring(
+  const Polygon &ring,
+  const Locator &locator,
+  const Triang &triang,
+  const unsigned int lx,
+  const unsigned int ly,
+  std::vector<Hit> &hits,
+  Polygon &ring_dens)
+{
+  ring_dens.reserve(ring.size() * 2);
+  const std::size_t sz = ring.size();
+  for (std::size_t i = 0; i < sz; ++i) {
+    const Point a = ring[i];
+    const Point b = (i + 1 == sz) ? ring[0] : ring[i + 1];
+    append_densified_segment(a, b, locator, triang, lx, ly, hits, ring_dens);
+  }
+}
+}  // namespace leaf_walk
+
+#endif  // DENSIFY_RING_HPP_
@@ -0,0 +1,74 @@
+#ifndef FFTW_PLANNER_HPP_
+#define FFTW_PLANNER_HPP_
+
+#include <cstddef>
+#include <fftw3.h>
+#include <string>
+
+// Process-wide settings of the FFTW planner. All plans are created through
+// make_r2r_2d_plan() so that they share these settings. FFTW's planner is
+// not thread-safe, so set_fftw_n_threads(), use_fftw_wisdom_file() and
+// make_r2r_2d_plan() must not be called concurrently.
+
+// Set the number of threads used by FFTW plans that are created after this
+// call. Has no effect if FFTW was built without thread support.
+void set_fftw_n_threads(unsigned int n_threads);
+
+// Import the FFTW wisdom stored at `path` (if the file exists) and create
+// all further plans with FFTW_MEASURE, or FFTW_PATIENT if `patient` is true.
+// Whenever planning produces new wisdom, it is written back to `path`.
+void use_fftw_wisdom_file(const std::string &path, bool patient);
+
+// Create a two-dimensional real-to-real plan for an lx x ly array. Unless
+// the planner only estimates, the contents of `in` and `out` are
+// overwritten. The overload for float creates a single-precision plan.
+fftw_plan make_r2r_2d_plan(
+  unsigned int lx,
+  unsigned int ly,
+  double *in,
+  double *out,
+  fftw_r2r_kind kind0,
+  fftw_r2r_kind kind1);
+fftwf_plan make_r2r_2d_plan(
+  unsigned int lx,
+  unsigned int ly,
+  float *in,
+  float *out,
+  fftw_r2r_kind kind0,
+  fftw_r2r_kind kind1);
+
+// Process-wide pool of FFTW buffers and plans. Growing the grid or moving on
+// to the next inset returns buffers to the pool instead of freeing them, and
+// plans are kept for the lifetime of the process, so a grid size that has
+// been seen before is neither reallocated nor replanned. The pool functions
+// are thread-safe.
+
+// Buffer of n doubles (floats), aligned as required by FFTW. Its contents
+// are undefined.
+double *acquire_fftw_buffer(size_t n);
+float *acquire_fftwf_buffer(size_t n);
+
+// Return a buffer obtained from acquire_fftw_buffer(n) or
+// acquire_fftwf_buffer(n) to the pool
+void release_fftw_buffer(double *buffer, size_t n);
+void release_fftw_buffer(float *buffer, size_t n);
+
+// Plan for an lx x ly transform of the given kinds, in place or from one
+// buffer to another. The plan is owned by the pool and must only be run
+// with fftw_execute_r2r() on buffers obtained from acquire_fftw_buffer().
+// pooled_r2r_2d_planf() is the single-precision equivalent, to be run with
+// fftwf_execute_r2r() on buffers from acquire_fftwf_buffer().
+fftw_plan pooled_r2r_2d_plan(
+  unsigned int lx,
+  unsigned int ly,
+  fftw_r2r_kind kind0,
+  fftw_r2r_kind kind1,
+  bool in_place);
+fftwf_plan pooled_r2r_2d_planf(
+  unsigned int lx,
+  unsigned int ly,
+  fftw_r2r_kind kind0,
+  fftw_r2r_kind kind1,
+  bool in_place);
+
+#endif  // FFTW_PLANNER_HPP_
@@ -0,0 +1,52 @@
+#ifndef FP32_STALL_DETECTOR_HPP_
+#define FP32_STALL_DETECTOR_HPP_
+
+#include "constants.hpp"
+
+// Decides when --fp32_spectral should switch to double precision. An
+// integration stalls if it does not reduce the maximum area error below
+// fp32_spectral_stall_ratio times its previous value. Single stalls are
+// normal near convergence, so only fp32_spectral_max_stalls consecutive
+// stalls cause the switch. The first integration after the grid has been
+// refined is not judged.
+class Fp32StallDetector
+{
+public:
+  // Start over from the maximum area error before the first integration
+  void reset(const double max_area_error)
+  {
+    prev_max_area_error_ = max_area_error;
+    n_stalls_ = 0;
+    skip_next_ = false;
+  }
+
+  // The grid has been refined, so do not judge the next integration
+  void grid_changed()
+  {
+    n_stalls_ = 0;
+    skip_next_ = true;
+  }
+
+  // Record the maximum area error after an integration. Returns true if
+  // single precision should be abandoned.
+  bool stalled_after(const double max_area_error)
+  {
+    if (skip_next_) {
+      skip_next_ = false;
+    } else if (
+      max_area_error >= fp32_spectral_stall_ratio * prev_max_area_error_) {
+      ++n_stalls_;
+    } else {
+      n_stalls_ = 0;
+    }
+    prev_max_area_error_ = max_area_error;
+    return n_stalls_ >= fp32_spectral_max_stalls;
+  }
+
+private:
+  double prev_max_area_error_{dbl_inf};
+  unsigned int n_stalls_{0};
+  bool skip_next_{false};
+};
+
+#endif  // FP32_STALL_DETECTOR_HPP_
@@ -3,15 +3,27 @@
 
 #include <fftw3.h>
 
-class FTReal2d
+// FFTW plan type for arrays of T
+template <typename T> struct FFTWPlan;
+template <> struct FFTWPlan<double> {
+  using type = fftw_plan;
+};
+template <> struct FFTWPlan<float> {
+  using type = fftwf_plan;
+};
+
+// Two-dimensional array for in-place real-to-real Fourier transforms. The
+// array and its plan are leased from the pool in fftw_planner.hpp: allocate()
+// and make_fftw_plan() take them from the pool, and free() returns the array.
+template <typename T> class BasicFTReal2d
 {
 private:
-  double *array_ = nullptr;
+  T *array_ = nullptr;
   unsigned int lx_ = 0, ly_ = 0;  // Lattice dimensions
-  fftw_plan plan_;
+  typename FFTWPlan<T>::type plan_ = nullptr;
 
 public:
-  [[nodiscard]] double *as_1d_array() const;
+  [[nodiscard]] T *as_1d_array() const;
   void set_array_size(unsigned int, unsigned int);
   void allocate(unsigned int, unsigned int);
   void free();
@@ -20,10 +32,17 @@ public:
   void destroy_fftw_plan();
 
   // Setter for array elements
-  double &operator()(unsigned int, unsigned int);
+  T &operator()(unsigned int, unsigned int);
 
   // Getter for array elements
-  double operator()(unsigned int, unsigned int) const;
+  T operator()(unsigned int, unsigned int) const;
 };
 
-#endif  // FT_REAL_2D_HPP_
\ No newline at end of file
+// Single precision is only used for the spectral stages with --fp32_spectral
+using FTReal2d = BasicFTReal2d<double>;
+using FTReal2df = BasicFTReal2d<float>;
+
+extern template class BasicFTReal2d<double>;
+extern template class BasicFTReal2d<float>;
+
+#endif  // FT_REAL_2D_HPP_
@@ -30,7 +30,32 @@ public:
   void push_back(const Polygon_with_holes &);
   std::vector<Polygon_with_holes> &ref_to_polygons_with_holes();
   void sort_pwh_descending_by_area();
+
+  // Apply given function to all points
+  template <class Transformer> void transform_points(Transformer &&);
   void update_id(const std::string &);
 };
 
+template <class Transformer>
+void GeoDiv::transform_points(Transformer &&transform_point)
+{
+  // Iterate over Polygon_with_holes
+  for (auto &pwh : polygons_with_holes_) {
+
+    // Iterate over outer boundary's coordinates
+    for (auto &coords_outer : pwh.outer_boundary()) {
+      coords_outer = transform_point(coords_outer);
+    }
+
+    // Iterate over holes
+    for (auto &h : pwh.holes()) {
+
+      // Iterate over hole's coordinates
+      for (auto &coords_hole : h) {
+        coords_hole = transform_point(coords_hole);
+      }
+    }
+  }
+}
+
 #endif  // GEO_DIV_HPP_
@@ -3,18 +3,25 @@
 
 #include "colors.hpp"
 #include "constants.hpp"
+#include "fp32_stall_detector.hpp"
 #include "ft_real_2d.hpp"
 #include "geo_div.hpp"
 #include "intersection.hpp"
+#include "min_max_pyramid.hpp"
 #include "nlohmann/json.hpp"
 #include "parse_arguments.hpp"
 #include "progress_tracker.hpp"
 #include "projection_data.hpp"
+#include "quadtree.hpp"
 #include "quadtree_leaf_locator.hpp"
+#include "raster_workspace.hpp"
+#include "spectral_stage.hpp"
 #include "time_tracker.hpp"
 #include "triangulation.hpp"
+#include "velocity_field.hpp"
 #include <boost/multi_array.hpp>
 #include <cstdint>
+#include <optional>
 
 struct max_area_error_info {
   double value;
@@ -32,11 +39,29 @@ struct max_area_error_info {
 class InsetState
 {
 private:
-  std::unordered_map<std::string, double> area_errors_;
+  std::vector<double> area_errors_;
 
   std::vector<QuadtreeCorner> unique_quadtree_corners_;
   ProjectionData proj_data_;
   QuadtreeLeafLocator qt_locator_;
+
+  // Minimum and maximum of rho_init_ over the quadtree's blocks
+  MinMaxPyramid rho_pyramid_;
+
+  // State kept between integrations with --incremental_quadtree
+  using DensityQuadtree = Quadtree<BlockRangeMetric<MinMaxPyramid>>;
+  struct IncrementalQuadtree {
+    std::optional<DensityQuadtree> tree;
+    unsigned int lx = 0, ly = 0;
+
+    // Blurred density when each cell was last revisited, its change since
+    // then, and the extremes of the change over the quadtree's blocks
+    std::vector<double> rho, rho_change;
+    MinMaxPyramid change_pyramid;
+
+    // Number of quadtree leaves inside the grid that have each corner
+    std::vector<uint8_t> corner_leaves;
+  } incremental_qt_;
   Triangulation<QuadtreeLeafLocator, ProjectionData> triang_;
 
   // Failed constraints
@@ -52,7 +77,7 @@ private:
 
   Bbox bbox_;
   fftw_plan bwd_plan_for_rho_{};
-  std::unordered_map<std::string, Color> colors_;
+  std::vector<std::optional<Color>> colors_;
 
   Arguments args_;
   TimeTracker timer;
@@ -73,8 +98,10 @@ private:
   // Geographic divisions in this inset
   std::vector<GeoDiv> geo_divs_;
 
-  // Create a map from GeoDiv ID to index in geo_divs_
-  std::map<std::string, size_t> geo_divs_id_to_index_;
+  // Dense index of each GeoDiv ID in geo_divs_. The per-GeoDiv attributes
+  // (area errors, colors, labels and target areas) are vectors with the same
+  // index, so that string IDs are only needed for input and output.
+  std::unordered_map<std::string, uint32_t> geo_divs_id_to_index_;
 
   // Copy of original data
   std::vector<GeoDiv> geo_divs_original_;
@@ -97,8 +124,8 @@ private:
 
   // Map name. Inset position is appended to the name if n_insets > 2.
   std::string inset_name_;
-  std::unordered_map<std::string, bool> is_input_target_area_missing_;
-  std::unordered_map<std::string, std::string> labels_;
+  std::vector<bool> is_input_target_area_missing_;
+  std::vector<std::string> labels_;  // Empty if the GeoDiv has no label
   unsigned int lx_{}, ly_{};  // Lattice dimensions
   unsigned int n_fails_during_flatten_density_;
   unsigned int n_finished_integrations_;
@@ -108,7 +135,41 @@ private:
 
   // Rasterized density, flux and its Fourier transform
   FTReal2d rho_ft_, rho_init_, grid_fluxx_init_, grid_fluxy_init_;
-  std::unordered_map<std::string, double> target_areas_;
+
+  // Single-precision replacements for rho_ft_ and the flux grids, used while
+  // fp32_spectral_ is true. rho_init_ stays in double precision. Its
+  // transforms go through a single-precision copy in rho_init_f_.
+  FTReal2df rho_ft_f_, grid_fluxx_init_f_, grid_fluxy_init_f_, rho_init_f_;
+  fftwf_plan fwd_plan_for_rho_f_{}, bwd_plan_for_rho_f_{};
+  bool fp32_spectral_{false};
+
+  // Detects when single precision stops the area error from decreasing
+  Fp32StallDetector fp32_stall_;
+
+  // Blur and flux multipliers for the Fourier coefficients
+  SpectralStage spectral_stage_;
+
+  // Scratch buffers for flatten_density_on_node_vertices(). They are kept
+  // between calls so that an integration does not reallocate them.
+  struct IntegrationWorkspace {
+    std::vector<Vector> v_intp;  // Velocity at the start of the time step
+    std::vector<Point> mid;  // Position proposed by the midpoint method
+    VelocityField velocity_field;
+  } integration_ws_;
+
+  // Scratch buffers for fill_with_density_clip(), kept between integrations
+  RasterWorkspace raster_ws_;
+
+  // Bytes held by raster_ws_ after each integration's density fill, and the
+  // bytes newly allocated for it in that integration
+  struct RasterBytes {
+    size_t held = 0;
+    size_t allocated = 0;
+  };
+  std::vector<RasterBytes> raster_bytes_;
+
+  // NaN until a target area is inserted
+  std::vector<double> target_areas_;
 
   // Area errors
   std::vector<double> max_area_errors_;
@@ -126,12 +187,17 @@ public:
   explicit InsetState(std::string, Arguments);
   void adjust_for_dual_hemisphere();
   void adjust_grid();
+
+  // Allocate the grids for the Fourier transforms, in single precision if
+  // fp32_spectral_ is true, and make their FFTW plans
+  void allocate_ft_grids();
   void apply_albers_projection();
   void apply_smyth_craster_projection();
 
   // Calculate difference between initial area and current area
   double area_expansion_factor() const;
   double area_error_at(const std::string &) const;
+  double area_error_at(uint32_t gd_index) const;
   void auto_color();  // Automatically color GeoDivs
   Bbox bbox(bool = false) const;
   void blur_density();
@@ -141,32 +207,45 @@ public:
   void cleanup_after_integration();
 
   Color color_at(const std::string &) const;
+  Color color_at(uint32_t gd_index) const;
   bool color_found(const std::string &) const;
   size_t colors_size() const;
   bool continue_integrating() const;
   void create_and_refine_quadtree();
+
+  // With --incremental_quadtree, adapt the quadtree of the previous
+  // integration to the current density. Returns false if there is none.
+  bool update_quadtree();
   void create_contiguity_graph();
   bool create_delaunay_t();
   bool converged() const;
   void densify_geo_divs_using_delaunay_t();
   void destroy_fftw_plans_for_flux();
   void destroy_fftw_plans_for_rho();
-  void execute_fftw_bwd_plan() const;
-  void execute_fftw_fwd_plan() const;
+  void execute_fftw_bwd_plan();
+  void execute_fftw_fwd_plan();
   void execute_fftw_plans_for_flux();
 
   // Write CSV of time and max_area_error per integration
   void export_time_report() const;
 
+  // Switch from single to double precision if the last integrations did not
+  // decrease the maximum area error enough
+  void fall_back_to_fp64_if_stalled();
+
   // Density functions
   void fill_with_density();
   void fill_with_density_clip();  // Fill map with density, using clipping
   bool flatten_density();  // Flatten said density with integration
   bool flatten_density_on_node_vertices();  // Bool to check if failed
+  void free_ft_grids();
 
   const std::vector<GeoDiv> &geo_divs() const;
   const GeoDiv &geo_div_at_id(std::string id) const;
   GeoDiv &geo_div_at_id(std::string id);
+
+  // Index of the GeoDiv with the given ID in geo_divs()
+  uint32_t geo_div_index(const std::string &) const;
   Polygon grid_cell_edge_points(
     unsigned int x,
     unsigned int y,
@@ -198,6 +277,7 @@ public:
   bool is_input_target_area_missing(const std::string &) const;
   void is_simple(const char *caller_func) const;
   std::string label_at(const std::string &) const;
+  const std::string &label_at(uint32_t gd_index) const;
   double latt_const() const;
   unsigned int lx() const;
   unsigned int ly() const;
@@ -231,6 +311,7 @@ public:
   FTReal2d &ref_to_rho_init();
   void remove_tiny_polygons(const double &minimum_polygon_size);
   void replace_target_area(const std::string &, double);
+  void replace_target_area(uint32_t gd_index, double);
   void rescale_map();
   void set_area_errors();
   void set_grid_dimensions(unsigned int, unsigned int);
@@ -243,7 +324,9 @@ public:
   template <class QuadtreeImp>
   void store_quadtree_cell_corners(const QuadtreeImp &qt);
   double target_area_at(const std::string &) const;
+  double target_area_at(uint32_t gd_index) const;
   bool target_area_is_missing(const std::string &) const;
+  bool target_area_is_missing(uint32_t gd_index) const;
   double total_inset_area(bool = false) const;
   double total_target_area() const;
 
@@ -279,34 +362,12 @@ void InsetState::transform_points(
   auto &geo_divs =
     project_original ? geo_divs_original_transformed_ : geo_divs_;
 
-  // Iterate over GeoDivs
-#pragma omp parallel for default(none) shared(transform_point, geo_divs)
-  for (auto &gd : geo_divs) {
-
-    // Iterate over Polygon_with_holes
-    for (auto &pwh : gd.ref_to_polygons_with_holes()) {
-
-      // Get outer boundary
-      auto &outer_boundary = pwh.outer_boundary();
-
-      // Iterate over outer boundary's coordinates
-      for (auto &coords_outer : outer_boundary) {
-
-        // Assign outer boundary's coordinates to transformed coordinates
-        coords_outer = transform_point(coords_outer);
-      }
-
-      // Iterate over holes
-      for (auto &h : pwh.holes()) {
-
-        // Iterate over hole's coordinates
-        for (auto &coords_hole : h) {
-
-          // Assign hole's coordinates to transformed coordinates
-          coords_hole = transform_point(coords_hole);
-        }
-      }
-    }
+  // Iterate over GeoDivs. Each GeoDiv is transformed by a single thread, so
+  // transform_point() must be safe to call concurrently.
+#pragma omp parallel for schedule(dynamic) default(none) \
+  shared(transform_point, geo_divs)
+  for (size_t i = 0; i < geo_divs.size(); ++i) {
+    geo_divs[i].transform_points(transform_point);
   }
 }
 
@@ -1,6 +1,8 @@
 #ifndef INTERPOL_HPP_
 #define INTERPOL_HPP_
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 template <typename VelocityCalculator>
@@ -0,0 +1,67 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Minimum and maximum of a row-major lx x ly grid over all aligned square
+// blocks whose side length is a power of two. Level k stores one (min, max)
+// pair per block of side 2^k, so that Quadtree can query the range of values
+// in any of its nodes in O(1) instead of scanning the node's cells. Blocks
+// that extend beyond the grid only aggregate the cells inside it.
+class MinMaxPyramid
+{
+public:
+  // Build all levels from grid[i * ly + j], 0 <= i < lx, 0 <= j < ly
+  void build(const double *grid, uint32_t lx, uint32_t ly);
+
+  // max - min over the block with lower-left cell (x, y) and side length
+  // size, where x and y are multiples of size. Like a scan over an empty
+  // block, a block outside the grid gives -infinity.
+  [[nodiscard]] double block_range(uint32_t x, uint32_t y, uint32_t size)
+    const noexcept
+  {
+    if (x >= lx_ || y >= ly_) {
+      return -std::numeric_limits<double>::infinity();
+    }
+
+    // A single cell has no range, so level 0 is not stored
+    if (size == 1) {
+      return 0.0;
+    }
+    const MinMax &m = block(x, y, size);
+    return m.max - m.min;
+  }
+
+  // Minimum and maximum over the block with lower-left cell (x, y), which
+  // must lie inside the grid, and side length size > 1
+  [[nodiscard]] std::pair<double, double>
+  block_min_max(uint32_t x, uint32_t y, uint32_t size) const noexcept
+  {
+    const MinMax &m = block(x, y, size);
+    return {m.min, m.max};
+  }
+
+private:
+  struct MinMax {
+    double min, max;
+  };
+
+  // Level k + 1 has nx x ny blocks of side 2^(k + 1)
+  struct Level {
+    uint32_t nx, ny;
+    std::vector<MinMax> cells;
+  };
+
+  [[nodiscard]] const MinMax &
+  block(uint32_t x, uint32_t y, uint32_t size) const noexcept
+  {
+    const auto k = static_cast<uint32_t>(std::countr_zero(size));
+    const Level &level = levels_[k - 1];
+    return level.cells[(x >> k) * level.ny + (y >> k)];
+  }
+
+  uint32_t lx_ = 0, ly_ = 0;
+  std::vector<Level> levels_;
+};
@@ -61,6 +61,13 @@ struct Arguments {
   // Quadtree leaf count factor (should be a power of 2)
   unsigned int quadtree_leaf_count_factor;
 
+  // Build and grade the quadtree level by level across threads
+  bool parallel_quadtree;
+
+  // Keep the quadtree between integrations and only revisit the blocks in
+  // which the density has changed
+  bool incremental_quadtree;
+
   // Other boolean values that are needed to parse the command line arguments
   bool make_csv;
   bool plot_density;
@@ -75,6 +82,20 @@ struct Arguments {
   // Timeout in seconds
   unsigned int timeout_in_seconds;
 
+  // Number of threads for parallel loops (0 means use the runtime default)
+  unsigned int n_threads;
+
+  // Produce bit-identical results regardless of the number of threads
+  bool deterministic;
+
+  // File in which FFTW wisdom is kept between runs (empty if none). If set,
+  // FFTW plans are measured instead of estimated.
+  std::string fftw_wisdom_file;
+  bool fftw_patient;
+
+  // Run the Fourier transforms and flux computation in single precision
+  bool fp32_spectral;
+
   // Whether to exit gracefully if intersections are found
   bool do_not_fail_on_intersections;
 
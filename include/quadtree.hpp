@@ -1,8 +1,10 @@
 #pragma once
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <cstdint>
+#include <utility>
 #include <vector>
 
 template <class F>
@@ -16,6 +18,32 @@ concept Metric =
     { a < b } -> std::convertible_to<bool>;  // Ensure the metric is comparable
   };
 
+// Pre-aggregated source of the range (max - min) of a field over the
+// aligned square blocks that are the quadtree nodes, e.g., MinMaxPyramid.
+// Nodes are then prioritised by block_range() without rescanning the field.
+template <class S>
+concept BlockRangeSource =
+  requires(const S &s, uint32_t x, uint32_t y, uint32_t size) {
+    { s.block_range(x, y, size) } -> std::convertible_to<double>;
+  };
+
+// Metric that prioritises a node by the range of the field in its block.
+// The source must outlive the Quadtree, or be replaced with set_metric().
+template <BlockRangeSource Source> struct BlockRangeMetric {
+  const Source *source;
+
+  double operator()(uint32_t x, uint32_t y, uint32_t size) const
+  {
+    return static_cast<double>(source->block_range(x, y, size));
+  }
+};
+
+template <BlockRangeSource Source>
+[[nodiscard]] BlockRangeMetric<Source> block_range_metric(const Source &source)
+{
+  return {&source};
+}
+
 template <Metric MetricFn> class Quadtree
 {
 public:
@@ -79,64 +107,222 @@ public:
       // Cannot split further because already at the lowest resolution
       if (!n.is_leaf() || n.size == 1)
         continue;
+      split_threshold_ = n.priority;
       split_build(idx, cmp);
     }
   }
 
+  // Alternative to build() that splits many nodes at once, so that the
+  // metric is evaluated by several threads. Each round selects, among the
+  // current leaves, the nodes with the largest metric that are still needed
+  // to reach target_cells, and splits them level-synchronously. Like
+  // build(), it stops with between target_cells and target_cells + 2
+  // leaves, but newly created children only compete with the other leaves
+  // in the next round. The metric must be safe to call concurrently. The
+  // result does not depend on the number of threads.
+  void build_parallel()
+  {
+    heap_.clear();
+
+    // Nodes with larger metric first. Ties are broken by the node index so
+    // that the selection is reproducible.
+    auto higher_priority = [this](uint32_t a, uint32_t b) {
+      if (nodes_[b].priority < nodes_[a].priority)
+        return true;
+      if (nodes_[a].priority < nodes_[b].priority)
+        return false;
+      return a < b;
+    };
+
+    std::vector<uint32_t> candidates;
+    while (leaves_.size() < target_) {
+      candidates.clear();
+      for (uint32_t idx : leaves_) {
+        if (nodes_[idx].size > 1)
+          candidates.push_back(idx);
+      }
+      if (candidates.empty())
+        break;
+
+      // Each split adds three leaves
+      const std::size_t n_splits =
+        std::min(candidates.size(), (target_ - leaves_.size() + 2) / 3);
+      const auto last = candidates.begin() + std::ptrdiff_t(n_splits);
+      std::nth_element(
+        candidates.begin(),
+        last,
+        candidates.end(),
+        higher_priority);
+      candidates.erase(last, candidates.end());
+      split_threshold_ = nodes_[*std::min_element(
+                                  candidates.begin(),
+                                  candidates.end(),
+                                  [this](uint32_t a, uint32_t b) {
+                                    return nodes_[a].priority <
+                                           nodes_[b].priority;
+                                  })]
+                           .priority;
+      std::sort(candidates.begin(), candidates.end());
+      split_all(candidates, true);
+    }
+  }
+
   // Keep splitting the neighbors as long as depth difference is more than 1
   // Time complexity: O(n log n) where n is the target number of leaves
   // Number of new nodes that can be added by grading is bounded by 3 * target
   void grade()
   {
-    std::vector<uint32_t> q;
-    q.reserve(leaves_.size());
-    for (uint32_t id : leaves_)
-      q.push_back(id);
-
-    auto enqueue_children = [&](uint32_t parent) {
-      const int32_t fc = nodes_[parent].first_child;
-      assert(fc >= 0);
-      q.push_back(static_cast<uint32_t>(fc + 0));
-      q.push_back(static_cast<uint32_t>(fc + 1));
-      q.push_back(static_cast<uint32_t>(fc + 2));
-      q.push_back(static_cast<uint32_t>(fc + 3));
-    };
+    build_cell_index();
+    grade_from(std::vector<uint32_t>(leaves_.begin(), leaves_.end()));
+  }
 
-    while (!q.empty()) {
-      const uint32_t idx = q.back();
-      q.pop_back();
-      if (!nodes_[idx].is_leaf())
-        continue;  // it may have been split already
+  // Level-synchronous version of grade() with the same result. In each
+  // round, all leaves check their face neighbours in parallel, and all
+  // leaves that are too shallow are split at once.
+  void grade_parallel()
+  {
+    build_cell_index();
+    std::vector<unsigned char> too_shallow;
+    std::vector<uint32_t> to_split;
+    for (;;) {
+      too_shallow.assign(nodes_.size(), 0);
+      const std::size_t n_leaves = leaves_.size();
+
+      // A leaf that is deeper than a neighbour by more than one level marks
+      // the neighbour. Every unbalanced pair is found from its deeper side.
+#pragma omp parallel for schedule(static) default(none) \
+  shared(n_leaves, too_shallow)
+      for (std::size_t k = 0; k < n_leaves; ++k) {
+        const Node &n = nodes_[leaves_[k]];
+        const std::array<std::array<uint32_t, 2>, 4> face_cells = {{
+          {n.x ? n.x - 1 : n.x, n.y},
+          {std::min(n.x + n.size, root_size_ - 1), n.y},
+          {n.x, n.y ? n.y - 1 : n.y},
+          {n.x, std::min(n.y + n.size, root_size_ - 1)},
+        }};
+        for (const auto &[qx, qy] : face_cells) {
+          const uint32_t nb = cell_leaf(qx, qy);
+          if (n.depth > nodes_[nb].depth + 1) {
+#pragma omp atomic write
+            too_shallow[nb] = 1;
+          }
+        }
+      }
 
-      const uint32_t x = nodes_[idx].x;
-      const uint32_t y = nodes_[idx].y;
-      const uint32_t sz = nodes_[idx].size;
+      to_split.clear();
+      for (uint32_t idx : leaves_) {
+        if (too_shallow[idx])
+          to_split.push_back(idx);
+      }
+      if (to_split.empty())
+        break;
+      std::sort(to_split.begin(), to_split.end());
+      split_all(to_split, false);
+    }
+  }
 
-      auto check = [&](uint32_t qx, uint32_t qy) {
-        const uint32_t nb = locate_leaf(qx, qy);
-        if (nb == idx)
-          return;
+  // Leaves that update() added to or removed from the tree, and the leaves
+  // whose metric it evaluated for the whole block
+  struct UpdateReport {
+    std::vector<Leaf> added, removed, evaluated;
+  };
 
-        const Node &a = nodes_[idx];
-        const Node &b = nodes_[nb];
-        if (std::abs(int(a.depth) - int(b.depth)) > 1) {
-          const uint32_t shallow = (a.depth < b.depth) ? idx : nb;
-          if (nodes_[shallow].size > 1 && nodes_[shallow].is_leaf()) {
-            split_grade(shallow);
+  // Adapt the built and graded tree to a changed metric without rebuilding
+  // it. `changed(x, y, size)` must be true for every block in which the
+  // metric may have changed by more than the caller tolerates. Only those
+  // blocks are revisited. There, as in build(), nodes whose metric reaches
+  // split_threshold() are split, and subtrees whose root falls below it are
+  // merged into a leaf. If the tree then has fewer than target_cells leaves,
+  // the leaves with the largest metric are split as in build(). Finally,
+  // the neighbourhoods of all new leaves are graded again.
+  template <class ChangedFn> UpdateReport update(ChangedFn &&changed)
+  {
+    if (cell_node_.empty())
+      build_cell_index();
+    report_ = UpdateReport{};
+    journaling_ = true;
+
+    // Nodes to visit, and whether their block must be evaluated even if it
+    // did not change because the node is new
+    std::vector<std::pair<uint32_t, bool>> stack = {{0, false}};
+    while (!stack.empty()) {
+      const auto [idx, is_new] = stack.back();
+      stack.pop_back();
+      const Node &n = nodes_[idx];
+      if (!is_new && !changed(n.x, n.y, n.size))
+        continue;
 
-            // Recheck both sides and the new children
-            q.push_back(idx);
-            q.push_back(nb);
-            enqueue_children(shallow);
-          }
+      nodes_[idx].priority = metric_(n.x, n.y, n.size);
+      const bool split =
+        n.size > 1 && !(nodes_[idx].priority < split_threshold_);
+      if (n.is_leaf() && split) {
+        split_impl(idx, nullptr);
+        for (uint32_t c = 0; c < 4; ++c) {
+          stack.emplace_back(
+            static_cast<uint32_t>(nodes_[idx].first_child) + c,
+            true);
         }
-      };
+      } else if (!n.is_leaf() && split) {
+        for (uint32_t c = 0; c < 4; ++c) {
+          stack.emplace_back(
+            static_cast<uint32_t>(nodes_[idx].first_child) + c,
+            false);
+        }
+      } else {
+        if (!n.is_leaf())
+          merge(idx);
+        report_.evaluated.emplace_back(n.x, n.y, n.size);
+      }
+    }
 
-      check(x ? x - 1 : x, y);
-      check(x + sz, y);
-      check(x, y ? y - 1 : y);
-      check(x, y + sz);
+    // Leaves created above do not have a priority yet
+    if (leaves_.size() < target_) {
+      heap_.clear();
+      for (uint32_t idx : leaves_) {
+        if (nodes_[idx].size > 1)
+          heap_.push_back(idx);
+      }
+      build();
     }
+
+    // Unbalanced pairs involve a new leaf, which is found from the deeper
+    // side. Hence, grade from the new leaves and their neighbours.
+    std::vector<uint32_t> q;
+    for (const Leaf &leaf : report_.added) {
+      const uint32_t idx = cell_leaf(leaf.x, leaf.y);
+      if (nodes_[idx].size != leaf.size)
+        continue;  // Removed again
+      q.push_back(idx);
+      for (uint32_t k = 0; k < leaf.size; ++k) {
+        if (leaf.x > 0)
+          q.push_back(cell_leaf(leaf.x - 1, leaf.y + k));
+        if (leaf.y > 0)
+          q.push_back(cell_leaf(leaf.x + k, leaf.y - 1));
+        if (leaf.x + leaf.size < root_size_)
+          q.push_back(cell_leaf(leaf.x + leaf.size, leaf.y + k));
+        if (leaf.y + leaf.size < root_size_)
+          q.push_back(cell_leaf(leaf.x + k, leaf.y + leaf.size));
+      }
+    }
+    std::sort(q.begin(), q.end());
+    q.erase(std::unique(q.begin(), q.end()), q.end());
+    grade_from(std::move(q));
+
+    journaling_ = false;
+    return std::move(report_);
+  }
+
+  // Smallest metric of a node that build() split. Nodes with a smaller
+  // metric were left unsplit.
+  [[nodiscard]] MetricResultType split_threshold() const noexcept
+  {
+    return split_threshold_;
+  }
+
+  // Replace the metric, e.g., after its data have moved
+  void set_metric(MetricFn metric)
+  {
+    metric_ = std::move(metric);
   }
 
   [[nodiscard]] std::vector<Leaf> leaves() const
@@ -176,6 +362,10 @@ private:
     ensure_leafpos(idx);
     leaf_pos_[idx] = static_cast<uint32_t>(leaves_.size());
     leaves_.push_back(idx);
+    if (journaling_) {
+      const Node &n = nodes_[idx];
+      report_.added.emplace_back(n.x, n.y, n.size);
+    }
   }
 
   void remove_leaf(uint32_t idx)
@@ -188,6 +378,85 @@ private:
     leaf_pos_[last] = pos;
     leaves_.pop_back();
     leaf_pos_[idx] = uint32_t(-1);
+    if (journaling_) {
+      const Node &n = nodes_[idx];
+      report_.removed.emplace_back(n.x, n.y, n.size);
+    }
+  }
+
+  // Grade starting from the given leaves, see grade()
+  void grade_from(std::vector<uint32_t> q)
+  {
+    auto enqueue_children = [&](uint32_t parent) {
+      const int32_t fc = nodes_[parent].first_child;
+      assert(fc >= 0);
+      q.push_back(static_cast<uint32_t>(fc + 0));
+      q.push_back(static_cast<uint32_t>(fc + 1));
+      q.push_back(static_cast<uint32_t>(fc + 2));
+      q.push_back(static_cast<uint32_t>(fc + 3));
+    };
+
+    while (!q.empty()) {
+      const uint32_t idx = q.back();
+      q.pop_back();
+      if (!nodes_[idx].is_leaf())
+        continue;  // it may have been split already
+
+      const uint32_t x = nodes_[idx].x;
+      const uint32_t y = nodes_[idx].y;
+      const uint32_t sz = nodes_[idx].size;
+
+      auto check = [&](uint32_t qx, uint32_t qy) {
+        const uint32_t nb = cell_leaf(qx, qy);
+        if (nb == idx)
+          return;
+
+        const Node &a = nodes_[idx];
+        const Node &b = nodes_[nb];
+        if (std::abs(int(a.depth) - int(b.depth)) > 1) {
+          const uint32_t shallow = (a.depth < b.depth) ? idx : nb;
+          if (nodes_[shallow].size > 1 && nodes_[shallow].is_leaf()) {
+            split_grade(shallow);
+
+            // Recheck both sides and the new children
+            q.push_back(idx);
+            q.push_back(nb);
+            enqueue_children(shallow);
+          }
+        }
+      };
+
+      // Face neighbours. Cells outside the root are clamped to the nearest
+      // cell inside, which then lies in the leaf itself.
+      check(x ? x - 1 : x, y);
+      check(std::min(x + sz, root_size_ - 1), y);
+      check(x, y ? y - 1 : y);
+      check(x, std::min(y + sz, root_size_ - 1));
+    }
+  }
+
+  // Turn an internal node back into a leaf. The nodes of its subtree are
+  // marked as unused by pointing first_child at themselves, and each group
+  // of four siblings is reused by a later split.
+  void merge(uint32_t idx)
+  {
+    std::vector<uint32_t> groups = {
+      static_cast<uint32_t>(nodes_[idx].first_child)};
+    while (!groups.empty()) {
+      const uint32_t first = groups.back();
+      groups.pop_back();
+      for (uint32_t c = first; c < first + 4; ++c) {
+        if (nodes_[c].is_leaf())
+          remove_leaf(c);
+        else
+          groups.push_back(static_cast<uint32_t>(nodes_[c].first_child));
+        nodes_[c].first_child = static_cast<int32_t>(c);
+      }
+      free_groups_.push_back(first);
+    }
+    nodes_[idx].first_child = -1;
+    add_leaf(idx);
+    index_cells(idx);
   }
 
   template <class Cmp> void heap_push(uint32_t idx, Cmp cmp)
@@ -198,12 +467,21 @@ private:
 
   template <class Cmp> void split_impl(uint32_t idx, Cmp cmp)
   {
-    Node &p = nodes_[idx];
-    assert(p.is_leaf() && "split_impl called on non-leaf");
-    assert(p.size > 1 && "cannot split size == 1");
+    assert(nodes_[idx].is_leaf() && "split_impl called on non-leaf");
+    assert(nodes_[idx].size > 1 && "cannot split size == 1");
     remove_leaf(idx);
 
-    p.first_child = static_cast<int32_t>(nodes_.size());
+    // Reuse the nodes of a merged subtree if there are any
+    uint32_t first_child;
+    if (free_groups_.empty()) {
+      first_child = static_cast<uint32_t>(nodes_.size());
+      nodes_.resize(nodes_.size() + 4);
+    } else {
+      first_child = free_groups_.back();
+      free_groups_.pop_back();
+    }
+    const Node &p = nodes_[idx];
+    nodes_[idx].first_child = static_cast<int32_t>(first_child);
     const uint32_t child_size = p.size >> 1;
     const uint16_t next_depth = p.depth + 1;
 
@@ -222,10 +500,14 @@ private:
           priority = MetricResultType{};
         }
 
-        nodes_.push_back({cx, cy, child_size, next_depth, -1, priority});
-        const uint32_t cid = static_cast<uint32_t>(nodes_.size() - 1);
+        const uint32_t cid = first_child + 2 * dy + dx;
+        nodes_[cid] = {cx, cy, child_size, next_depth, -1, priority};
         add_leaf(cid);
 
+        // The cell index is only kept once grading has built it
+        if (!cell_node_.empty())
+          index_cells(cid);
+
         if constexpr (maintain_heap) {
           heap_push(cid, cmp);
         }
@@ -242,17 +524,73 @@ private:
     split_impl(idx, nullptr);
   }
 
-  uint32_t locate_leaf(uint32_t px, uint32_t py) const
+  // Split the given leaves, which must be larger than one cell. The
+  // children are created in parallel. Their metric is only evaluated if
+  // with_metric is true, i.e., not during grading.
+  void split_all(const std::vector<uint32_t> &parents, bool with_metric)
   {
-    uint32_t idx = 0;
-    while (!nodes_[idx].is_leaf()) {
-      const Node &n = nodes_[idx];
-      const uint32_t half = n.size >> 1;
-      const bool right = px >= n.x + half;
-      const bool bottom = py >= n.y + half;
-      idx = static_cast<uint32_t>(n.first_child + (bottom << 1) + right);
+    const std::size_t first = nodes_.size();
+    const std::size_t n_parents = parents.size();
+    nodes_.resize(first + 4 * n_parents);
+    for (std::size_t r = 0; r < n_parents; ++r) {
+      assert(nodes_[parents[r]].is_leaf() && nodes_[parents[r]].size > 1);
+      remove_leaf(parents[r]);
+      nodes_[parents[r]].first_child = static_cast<int32_t>(first + 4 * r);
+    }
+    const bool indexed = !cell_node_.empty();
+
+#pragma omp parallel for schedule(dynamic, 16) default(none) \
+  shared(parents, first, n_parents, with_metric, indexed)
+    for (std::size_t r = 0; r < n_parents; ++r) {
+      const Node &p = nodes_[parents[r]];
+      const uint32_t child_size = p.size >> 1;
+      for (uint32_t c = 0; c < 4; ++c) {
+        const uint32_t cx = p.x + (c & 1) * child_size;
+        const uint32_t cy = p.y + (c >> 1) * child_size;
+        const auto cid = static_cast<uint32_t>(first + 4 * r + c);
+        nodes_[cid] = {
+          cx,
+          cy,
+          child_size,
+          static_cast<uint16_t>(p.depth + 1),
+          -1,
+          with_metric ? metric_(cx, cy, child_size) : MetricResultType{}};
+        if (indexed)
+          index_cells(cid);
+      }
+    }
+    for (std::size_t cid = first; cid < nodes_.size(); ++cid) {
+      add_leaf(static_cast<uint32_t>(cid));
+    }
+  }
+
+  // Point the cells of a leaf's block to the leaf in cell_node_
+  void index_cells(uint32_t idx)
+  {
+    const Node &n = nodes_[idx];
+    for (uint32_t x = n.x; x < n.x + n.size; ++x) {
+      uint32_t *column = cell_node_.data() + std::size_t(x) * root_size_;
+      std::fill(column + n.y, column + n.y + n.size, idx);
     }
-    return idx;
+  }
+
+  // Index every cell of the root by the leaf that contains it, so that
+  // grade() finds neighbours with one load instead of a walk from the root
+  void build_cell_index()
+  {
+    cell_node_.resize(std::size_t(root_size_) * root_size_);
+    const std::size_t n_leaves = leaves_.size();
+
+    // Leaves do not overlap, so each cell is written by exactly one thread
+#pragma omp parallel for schedule(dynamic, 64) default(none) shared(n_leaves)
+    for (std::size_t k = 0; k < n_leaves; ++k) {
+      index_cells(leaves_[k]);
+    }
+  }
+
+  [[nodiscard]] uint32_t cell_leaf(uint32_t px, uint32_t py) const
+  {
+    return cell_node_[std::size_t(px) * root_size_ + py];
   }
 
   uint32_t root_size_;
@@ -263,4 +601,15 @@ private:
   std::vector<uint32_t> leaves_;
   std::vector<uint32_t> heap_;
   std::vector<uint32_t> leaf_pos_;
+  std::vector<uint32_t> cell_node_;
+
+  // Smallest metric of a node split by build() or build_parallel()
+  MetricResultType split_threshold_{};
+
+  // First nodes of the groups of four siblings freed by merge()
+  std::vector<uint32_t> free_groups_;
+
+  // While update() runs, leaves added and removed are recorded in report_
+  bool journaling_ = false;
+  UpdateReport report_;
 };
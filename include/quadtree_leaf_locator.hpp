@@ -1,8 +1,29 @@
 #pragma once
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <iterator>
 #include <vector>
 
+// Interleave the bits of x and y (x in the even bits) so that sorting by the
+// code orders cells along the Z-order curve
+[[nodiscard]] constexpr uint64_t morton_code(uint32_t x, uint32_t y) noexcept
+{
+  auto spread = [](uint64_t v) {
+    v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+    v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+    v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    v = (v | (v << 1)) & 0x5555555555555555ULL;
+    return v;
+  };
+  return spread(x) | (spread(y) << 1);
+}
+
+// Linear quadtree: the leaves, sorted by the Morton code of their
+// bottom-left cell, and a dense lx x ly index from each grid cell to the
+// leaf that contains it. Locating a point is then a single table load
+// instead of a walk from the root.
 class QuadtreeLeafLocator
 {
 public:
@@ -16,38 +37,55 @@ public:
     bool operator==(const Leaf &) const noexcept = default;
   };
 
-  struct Node {
-    uint32_t x, y, size;
-    int32_t first_child;
-    Node() = default;
-    Node(uint32_t x_, uint32_t y_, uint32_t s_, int32_t first_child_)
-        : x(x_), y(y_), size(s_), first_child(first_child_)
-    {
-    }
-    [[nodiscard]] bool is_leaf() const noexcept
-    {
-      return first_child < 0;
-    }
-  };
-
   QuadtreeLeafLocator() = default;
 
+  // Build from the node array of a Quadtree. Only the leaves are kept.
   template <typename QuadtreeNodeCollection>
   void build(uint32_t lx, uint32_t ly, const QuadtreeNodeCollection &nodes)
   {
     root_size_ = std::max(lx, ly);
     lx_ = lx;
     ly_ = ly;
-    nodes_.clear();
-    nodes_.reserve(nodes.size());
+    leaves_.clear();
     for (const auto &node : nodes) {
-      nodes_.emplace_back(node.x, node.y, node.size, node.first_child);
+      if (node.first_child < 0) {
+        leaves_.emplace_back(node.x, node.y, node.size);
+      }
+    }
+    std::sort(
+      leaves_.begin(),
+      leaves_.end(),
+      [](const Leaf &a, const Leaf &b) {
+        return morton_code(a.x, a.y) < morton_code(b.x, b.y);
+      });
+    domain_leaves_.clear();
+    std::copy_if(
+      leaves_.begin(),
+      leaves_.end(),
+      std::back_inserter(domain_leaves_),
+      [lx, ly](const Leaf &leaf) {
+        return leaf.x + leaf.size <= lx && leaf.y + leaf.size <= ly;
+      });
+
+    // Leaves do not overlap, so each cell is written by exactly one thread
+    cell_leaf_.resize(static_cast<size_t>(lx) * ly);
+#pragma omp parallel for schedule(dynamic, 64) default(none) shared(lx, ly)
+    for (size_t k = 0; k < leaves_.size(); ++k) {
+      const Leaf &leaf = leaves_[k];
+      const uint32_t x_end = std::min(leaf.x + leaf.size, lx);
+      const uint32_t y_end = std::min(leaf.y + leaf.size, ly);
+
+      // Leaves above the grid have no cells in it
+      for (uint32_t x = leaf.x; x < x_end && leaf.y < y_end; ++x) {
+        uint32_t *column = cell_leaf_.data() + static_cast<size_t>(x) * ly;
+        std::fill(column + leaf.y, column + y_end, static_cast<uint32_t>(k));
+      }
     }
   }
 
   [[nodiscard]] bool empty() const noexcept
   {
-    return nodes_.empty();
+    return leaves_.empty();
   }
 
   [[nodiscard]] uint32_t root_size() const noexcept
@@ -55,9 +93,9 @@ public:
     return root_size_;
   }
 
-  [[nodiscard]] uint32_t num_nodes() const noexcept
+  [[nodiscard]] uint32_t num_leaves() const noexcept
   {
-    return static_cast<uint32_t>(nodes_.size());
+    return static_cast<uint32_t>(leaves_.size());
   }
 
   template <typename Point>
@@ -66,52 +104,34 @@ public:
     return locate(pt.x(), pt.y());
   }
 
+  // Leaf that contains (px, py). Points outside the grid are clamped to the
+  // nearest grid cell.
   [[nodiscard]] Leaf locate(double px, double py) const noexcept
   {
     const double rx = (px <= 0.0) ? 0.0
-                      : (px < double(root_size_))
+                      : (px < double(lx_))
                         ? px
-                        : std::nextafter(double(root_size_), 0.0);
+                        : std::nextafter(double(lx_), 0.0);
     const double ry = (py <= 0.0) ? 0.0
-                      : (py < double(root_size_))
+                      : (py < double(ly_))
                         ? py
-                        : std::nextafter(double(root_size_), 0.0);
+                        : std::nextafter(double(ly_), 0.0);
 
     const uint32_t ix = static_cast<uint32_t>(rx);
     const uint32_t iy = static_cast<uint32_t>(ry);
-    const uint32_t idx = locate_leaf(ix, iy);
-    const Node &n = nodes_[idx];
-    return {n.x, n.y, n.size};
+    return leaves_[cell_leaf_[static_cast<size_t>(ix) * ly_ + iy]];
   }
 
-  [[nodiscard]] std::vector<Leaf> leaves() const
+  // Leaves that lie completely inside the grid, in Morton order
+  [[nodiscard]] const std::vector<Leaf> &leaves() const noexcept
   {
-    std::vector<Leaf> out;
-    out.reserve(nodes_.size());
-    for (const auto &node : nodes_) {
-      if (
-        node.is_leaf() && node.x + node.size <= lx_ &&
-        node.y + node.size <= ly_) {
-        out.emplace_back(node.x, node.y, node.size);
-      }
-    }
-    return out;
+    return domain_leaves_;
   }
 
 private:
-  uint32_t locate_leaf(uint32_t px, uint32_t py) const
-  {
-    uint32_t idx = 0;
-    while (!nodes_[idx].is_leaf()) {
-      const Node &n = nodes_[idx];
-      const uint32_t half = n.size >> 1;
-      const bool right = px >= n.x + half;
-      const bool bottom = py >= n.y + half;
-      idx = static_cast<uint32_t>(n.first_child + (bottom << 1) + right);
-    }
-    return idx;
-  }
   uint32_t lx_{}, ly_{};
   uint32_t root_size_ = 0;
-  std::vector<Node> nodes_;
+  std::vector<Leaf> leaves_;
+  std::vector<Leaf> domain_leaves_;  // Subset of leaves_ inside the grid
+  std::vector<uint32_t> cell_leaf_;
 };
@@ -0,0 +1,51 @@
+#ifndef RASTER_WORKSPACE_HPP_
+#define RASTER_WORKSPACE_HPP_
+
+#include "coverage_raster.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Buffers of InsetState::fill_with_density_clip(). They are kept between
+// integrations and cleared without releasing their capacity, so that new
+// memory is only needed if the grid or the number of spans grows.
+struct RasterWorkspace {
+  // GeoDiv index and index within the GeoDiv of every pwh in the inset.
+  // Indices rather than pointers, because geo_divs_ is replaced between
+  // integrations and InsetState may be copied.
+  std::vector<std::pair<uint32_t, uint32_t>> pwhs;
+
+  // Coverage spans of each pwh, and of all pwhs sorted by column x
+  std::vector<std::vector<CoverageSpan>> pwh_spans;
+  std::vector<size_t> column_offsets;
+  std::vector<CoverageSpan> column_spans;
+
+  std::vector<double> gd_target_density;
+  std::vector<double> gd_area_error;
+
+  // Weighted density, weight and area of each cell in the current column,
+  // one buffer per thread
+  std::vector<std::vector<double>> column_sums;
+
+  // Bytes of memory held by the buffers
+  [[nodiscard]] size_t capacity_bytes() const
+  {
+    size_t bytes = pwhs.capacity() * sizeof(pwhs[0]) +
+                   pwh_spans.capacity() * sizeof(pwh_spans[0]) +
+                   column_offsets.capacity() * sizeof(size_t) +
+                   column_spans.capacity() * sizeof(CoverageSpan) +
+                   gd_target_density.capacity() * sizeof(double) +
+                   gd_area_error.capacity() * sizeof(double) +
+                   column_sums.capacity() * sizeof(column_sums[0]);
+    for (const auto &spans : pwh_spans) {
+      bytes += spans.capacity() * sizeof(CoverageSpan);
+    }
+    for (const auto &sums : column_sums) {
+      bytes += sums.capacity() * sizeof(double);
+    }
+    return bytes;
+  }
+};
+
+#endif  // RASTER_WORKSPACE_HPP_
@@ -0,0 +1,46 @@
+#ifndef SPECTRAL_STAGE_HPP_
+#define SPECTRAL_STAGE_HPP_
+
+#include "ft_real_2d.hpp"
+#include <vector>
+
+// Operations on the Fourier coefficients of the density between the forward
+// and the backward transforms. With the wave numbers u = i / lx and
+// v = j / ly, each coefficient rho_ft(i, j) is
+//   1. multiplied by the Gaussian blur weight w_x[i] * w_y[j], which also
+//      includes the normalisation 1 / (4 * lx * ly) of the transforms, and
+//   2. turned into the flux coefficients
+//        fluxx(i - 1, j) = -rho_ft(i, j) * u / (pi * (u^2 + v^2)),
+//        fluxy(i, j - 1) = -rho_ft(i, j) * v / (pi * (u^2 + v^2)).
+// Both steps are done in a single sweep over rho_ft, with one division per
+// coefficient. The wave number tables only depend on the grid size, so
+// they are computed once per (lx, ly).
+class SpectralStage
+{
+private:
+  unsigned int lx_ = 0, ly_ = 0;  // Lattice dimensions
+
+  // u = i / lx, u^2 and pi * u^2 for i < lx, and similarly for v
+  std::vector<double> u_, u2_, pi_u2_;
+  std::vector<double> v_, v2_, pi_v2_;
+
+  // Blur weights of the last call to blur_and_compute_flux()
+  std::vector<double> w_x_, w_y_;
+
+  void set_grid_size(unsigned int lx, unsigned int ly);
+
+public:
+  // Blur rho_ft in place and write the Fourier coefficients of the flux into
+  // grid_fluxx_init and grid_fluxy_init. A blur_width <= 0 only normalises
+  // rho_ft.
+  template <typename T>
+  void blur_and_compute_flux(
+    BasicFTReal2d<T> &rho_ft,
+    BasicFTReal2d<T> &grid_fluxx_init,
+    BasicFTReal2d<T> &grid_fluxy_init,
+    unsigned int lx,
+    unsigned int ly,
+    double blur_width);
+};
+
+#endif  // SPECTRAL_STAGE_HPP_
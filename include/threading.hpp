@@ -0,0 +1,19 @@
+#ifndef THREADING_HPP_
+#define THREADING_HPP_
+
+// Thin wrappers around the OpenMP runtime. Without OpenMP, the `#pragma omp`
+// annotations are ignored and these functions report a single thread, so the
+// rest of the code does not need any #ifdef _OPENMP.
+
+// Set the number of threads used by parallel regions. Zero keeps the
+// runtime's default (the OMP_NUM_THREADS environment variable or the number
+// of hardware threads).
+void set_n_threads(unsigned int n_threads);
+
+// Number of threads that the next parallel region will use
+unsigned int n_threads();
+
+// Index of the calling thread in the current parallel region (0 outside one)
+unsigned int thread_num();
+
+#endif  // THREADING_HPP_
@@ -1,7 +1,9 @@
 #pragma once
 #include "cgal_typedef.hpp"
 #include "quadtree_corner.hpp"
+#include "quadtree_leaf_locator.hpp"
 #include "round_point.hpp"
+#include "threading.hpp"
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Kernel/global_functions_2.h>
 #include <CGAL/enum.h>
@@ -11,11 +13,92 @@
 #include <cmath>
 #include <cstdint>
 #include <limits>
+#include <span>
+#include <utility>
 #include <vector>
 
 using EPICK = CGAL::Exact_predicates_inexact_constructions_kernel;
 using EPoint = EPICK::Point_2;
 
+namespace leaf_triangulation
+{
+// Possible boundary points of a leaf in units of half the leaf size, in
+// counter-clockwise order from the bottom-left corner. The odd positions are
+// the midpoints of the bottom, right, top and left edges. A midpoint is a
+// boundary point if the leaf next to that edge is smaller.
+inline constexpr std::array<std::array<uint32_t, 2>, 8> positions = {
+  {{0, 0}, {1, 0}, {2, 0}, {2, 1}, {2, 2}, {1, 2}, {0, 2}, {0, 1}}};
+
+// Boundary polygon of a leaf for one combination of edge midpoints
+struct Config {
+  uint32_t n = 0;  // Number of boundary points
+  std::array<uint8_t, 8> position{};  // Index into positions[]
+
+  // Bit k of candidates[i][j] is set if the boundary points i < k < j form
+  // a proper triangle, i.e., they do not lie on the same edge
+  std::array<std::array<uint8_t, 8>, 8> candidates{};
+};
+
+// Bit e of `midpoints` is set if the midpoint of edge e is a boundary point
+constexpr Config make_config(const unsigned int midpoints)
+{
+  Config c;
+  for (uint8_t p = 0; p < 8; ++p) {
+    if (p % 2 == 0 || ((midpoints >> (p / 2)) & 1u) != 0) {
+      c.position[c.n++] = p;
+    }
+  }
+  for (uint32_t i = 0; i < c.n; ++i) {
+    for (uint32_t k = i + 1; k < c.n; ++k) {
+      for (uint32_t j = k + 1; j < c.n; ++j) {
+        const auto &a = positions[c.position[i]];
+        const auto &b = positions[c.position[k]];
+        const auto &d = positions[c.position[j]];
+        const bool collinear = (a[0] == b[0] && b[0] == d[0]) ||
+                               (a[1] == b[1] && b[1] == d[1]);
+        if (!collinear) {
+          c.candidates[i][j] = static_cast<uint8_t>(
+            c.candidates[i][j] | (1u << k));
+        }
+      }
+    }
+  }
+  return c;
+}
+
+constexpr std::array<Config, 16> make_configs()
+{
+  std::array<Config, 16> configs{};
+  for (unsigned int m = 0; m < 16; ++m) {
+    configs[m] = make_config(m);
+  }
+  return configs;
+}
+
+inline constexpr std::array<Config, 16> configs = make_configs();
+
+// Increasing function of the smallest angle of triangle abc, so that
+// triangles can be compared without trigonometric functions. The smallest
+// angle lies opposite the shortest side and is at most 60 degrees. Hence,
+// its squared sine, (2 * area)^2 / (product of the two longer sides)^2,
+// increases with the angle.
+inline double min_angle_key(const Point &a, const Point &b, const Point &c)
+{
+  const double abx = b.x() - a.x(), aby = b.y() - a.y();
+  const double acx = c.x() - a.x(), acy = c.y() - a.y();
+  const double bcx = c.x() - b.x(), bcy = c.y() - b.y();
+  const double ab2 = abx * abx + aby * aby;
+  const double ac2 = acx * acx + acy * acy;
+  const double bc2 = bcx * bcx + bcy * bcy;
+  const double cross = abx * acy - aby * acx;
+  const double sides = ab2 * ac2 * bc2;
+  if (sides <= 0.0) {
+    return 0.0;
+  }
+  return cross * cross * std::min({ab2, ac2, bc2}) / sides;
+}
+}  // namespace leaf_triangulation
+
 template <class QuadtreeLocator, class Projection> class Triangulation
 {
 public:
@@ -25,6 +108,20 @@ public:
 
   using ConstTriangleIt = typename std::vector<Triangle>::const_iterator;
 
+  // Affine map from the original to the projected space that agrees with
+  // the projection at the three vertices of a triangle:
+  // (x, y) -> (xx * x + xy * y + x0, yx * x + yy * y + y0)
+  struct AffineMap {
+    double xx, xy, x0, yx, yy, y0;
+
+    [[nodiscard]] Point apply(const Point &p) const noexcept
+    {
+      return {
+        xx * p.x() + xy * p.y() + x0,
+        yx * p.x() + yy * p.y() + y0};
+    }
+  };
+
   // We first build per Quadtree leaf triangulation (we choose the
   // triangulation that maximizes the minimum angle in the projected space).
   // However, if the triangulation triangle flips in the projected space that
@@ -38,92 +135,107 @@ public:
     proj_data_ = proj_data;
 
     const auto &leaves = qt_locator_->leaves();
-    triangles_.reserve(leaves.size() * 4);
-    leaf_to_triangle_idxs_.resize(proj_data_->num_unique_corners());
+    const auto n_leaves = static_cast<uint32_t>(leaves.size());
+    leaf_index_.assign(proj_data_->num_unique_corners(), UINT32_MAX);
+    leaf_offsets_.resize(n_leaves + 1);
+    leaf_offsets_[0] = 0;
+
+    // The leaves are split into one contiguous chunk per thread. Each chunk
+    // is triangulated into its own buffer, so that concatenating the buffers
+    // in chunk order gives the same triangles as a serial build. The buffers
+    // keep their capacity between builds.
+    const uint32_t n_chunks = std::max(1u, std::min(n_threads(), n_leaves));
+    chunk_triangles_.resize(n_chunks);
 
     // The leaves from the qt_locator_ only contains the bottom-left corner
     // (x, y) and the size of the leaf. In order to triangulate the leaf, we
     // also need the potential midpoints of the edges (if the quadtree cells
     // besides the leaf have higher depth)
 
-    // Now for each leaf, we first construct the polygon of the leaf including
+    // Now for each leaf, we first look up the polygon of the leaf including
     // the potential midpoints of the edges. Then we triangulate the polygon
-    // to maximize the minimum angle in the projected space
-    for (const auto &leaf : leaves) {
-      const uint32_t x = leaf.x;
-      const uint32_t y = leaf.y;
-      const uint32_t s = leaf.size;
-
-      // Collect boundary in CCW: bl -> br -> tr -> tl (+ midpoints as needed)
-      std::vector<QuadtreeCorner> leaf_pts;
-      leaf_pts.reserve(8);
-
-      // bottom edge (bl -> br)
-      leaf_pts.push_back({x, y});
-
-      if (s > 1) {
-        const uint32_t x_mid = x + (s >> 1);
-        const uint32_t y_mid = y;
-        if (proj_data_->is_valid_corner(x_mid, y_mid)) {
-          leaf_pts.push_back({x_mid, y_mid});  // midpoint
+    // to maximize the minimum angle in the projected space. We return false
+    // in case any triangle of the optimal triangulation of any leaf flips in
+    // the projected space.
+    bool okay = true;
+#pragma omp parallel for schedule(static, 1) \
+  shared(leaves, n_leaves, n_chunks) reduction(&& : okay)
+    for (uint32_t c = 0; c < n_chunks; ++c) {
+      std::vector<Triangle> &buffer = chunk_triangles_[c];
+      buffer.clear();
+
+      // A leaf has at most eight boundary points and thus six triangles
+      const uint32_t begin = static_cast<uint32_t>(
+        uint64_t(n_leaves) * c / n_chunks);
+      const uint32_t end = static_cast<uint32_t>(
+        uint64_t(n_leaves) * (c + 1) / n_chunks);
+      buffer.reserve(size_t(end - begin) * 6);
+
+      for (uint32_t k = begin; k < end; ++k) {
+        const uint32_t x = leaves[k].x;
+        const uint32_t y = leaves[k].y;
+        const uint32_t s = leaves[k].size;
+
+        unsigned int midpoints = 0;
+        if (s > 1) {
+          const uint32_t h = s >> 1;
+          midpoints |= proj_data_->is_valid_corner(x + h, y) ? 1u : 0u;
+          midpoints |= proj_data_->is_valid_corner(x + s, y + h) ? 2u : 0u;
+          midpoints |= proj_data_->is_valid_corner(x + h, y + s) ? 4u : 0u;
+          midpoints |= proj_data_->is_valid_corner(x, y + h) ? 8u : 0u;
         }
-      }
-      leaf_pts.push_back({x + s, y});
-
-      // right edge (br -> tr)
-      if (s > 1) {
-        const uint32_t x_mid = x + s;
-        const uint32_t y_mid = y + (s >> 1);
-        if (proj_data_->is_valid_corner(x_mid, y_mid)) {
-          leaf_pts.push_back({x_mid, y_mid});  // midpoint
-        }
-      }
-      leaf_pts.push_back({x + s, y + s});
-
-      // top edge (tr -> tl)
-      if (s > 1) {
-        const uint32_t x_mid = x + (s >> 1);
-        const uint32_t y_mid = y + s;
-        if (proj_data_->is_valid_corner(x_mid, y_mid)) {
-          leaf_pts.push_back({x_mid, y_mid});  // midpoint
-        }
-      }
-      leaf_pts.push_back({x, y + s});
-
-      // left edge (tl -> bl)
-      if (s > 1) {
-        const uint32_t x_mid = x;
-        const uint32_t y_mid = y + (s >> 1);
-        if (proj_data_->is_valid_corner(x_mid, y_mid)) {
-          leaf_pts.push_back({x_mid, y_mid});  // midpoint
-        }
-      }
+        const auto &config = leaf_triangulation::configs[midpoints];
 
-      std::vector<Point> leaf_pts_proj;
-      leaf_pts_proj.reserve(leaf_pts.size());
-      for (size_t i = 0; i < leaf_pts.size(); ++i) {
-        const auto &pt = leaf_pts[i];
-        leaf_pts_proj.push_back(proj_data_->get(pt.x(), pt.y()));
-      }
+        std::array<Point, 8> leaf_pts_proj;
+        for (uint32_t i = 0; i < config.n; ++i) {
+          const QuadtreeCorner pt = corner(config, i, x, y, s);
+          leaf_pts_proj[i] = proj_data_->get(pt.x(), pt.y());
+        }
 
-      // Triangulate polygon to maximize minimum angle in projected space
-      // We return false from the triangulation in case any triangle of the
-      // optimal triangulation of the leaf flips in the projected space
-      if (!triangulate_max_min_angle(leaf_pts, leaf_pts_proj, x, y)) {
-        return false;
+        // Triangulate polygon to maximize minimum angle in projected space.
+        // Until the offsets are accumulated below, leaf_offsets_[k + 1]
+        // holds the number of triangles of leaf k.
+        const size_t first = buffer.size();
+        okay = triangulate_max_min_angle(
+                 config,
+                 leaf_pts_proj,
+                 x,
+                 y,
+                 s,
+                 buffer) &&
+               okay;
+        leaf_offsets_[k + 1] = static_cast<uint32_t>(buffer.size() - first);
+        leaf_index_[proj_data_->offset(x, y)] = k;
       }
     }
+    if (!okay) {
+      return false;
+    }
 
+    for (uint32_t k = 0; k < n_leaves; ++k) {
+      leaf_offsets_[k + 1] += leaf_offsets_[k];
+    }
+    triangles_.reserve(leaf_offsets_[n_leaves]);
+    for (const auto &buffer : chunk_triangles_) {
+      triangles_.insert(triangles_.end(), buffer.begin(), buffer.end());
+    }
+    build_affine_maps();
     return true;
   }
 
-  // Internally, we use the CGAL EPICK-based containment to locate the triangle
-  // that contains the point p. The benefit of this is that we do not have to
-  // worry about choosing the wrong triangle because of some bad choice of
-  // EPSILON. With EPICK, all predicates such as orientation, contains, etc.
-  // are exact, so we can use them directly without worrying about numerical
-  // issues
+  // The containment tests are exact, so we do not have to worry about
+  // choosing the wrong triangle because of some bad choice of EPSILON. Since
+  // all triangle vertices are integer grid corners, a floating-point test
+  // with a forward error bound decides almost all points. Only points
+  // (almost) on a triangle edge fall back to the exact CGAL EPICK predicates.
   ConstTriangleIt locate(const Point &p) const
+  {
+    return locate(p, last_locate_triangle_idx_);
+  }
+
+  // Same as above, but the index of the last located triangle is kept by the
+  // caller. Use this overload when locating points from several threads.
+  ConstTriangleIt locate(const Point &p, uint32_t &last_triangle_idx) const
   {
     auto contains = [&](const Triangle &T) -> bool {
       const EPoint A(T.vertices[0].x(), T.vertices[0].y());
@@ -152,9 +264,14 @@ public:
     // At the later stages, it is highly likely that many points will be within
     // the same triangle, so we can avoid the full `locate` cost by just doing
     // a low cost containment check in the last located triangle
-    if (last_locate_triangle_idx_ != UINT32_MAX) {
-      if (contains(triangles_[last_locate_triangle_idx_]))
-        return triangles_.cbegin() + last_locate_triangle_idx_;
+    if (last_triangle_idx != UINT32_MAX) {
+      const Containment c =
+        classify(triangles_[last_triangle_idx], p.x(), p.y());
+      if (
+        c == Containment::inside ||
+        (c == Containment::undecided &&
+         contains(triangles_[last_triangle_idx])))
+        return triangles_.cbegin() + last_triangle_idx;
     }
 
     // First find the leaf from quadtree that contains the point p
@@ -162,14 +279,30 @@ public:
     // leaf only has a handful of triangles)
     const auto leaf = qt_locator_->locate(p);
     const uint32_t key = proj_data_->offset(leaf.x, leaf.y);
-    assert(key < leaf_to_triangle_idxs_.size());
 
-    const auto &triangle_indices = leaf_to_triangle_idxs_[key];
-    assert(!triangle_indices.empty());
+    assert(key < leaf_index_.size());
+    const uint32_t leaf_idx = leaf_index_[key];
+    assert(leaf_idx != UINT32_MAX);
+
+    // Test all triangles of the leaf without branching on the result. The
+    // first triangle that contains p is selected, as in the exact loop below.
+    const uint32_t begin = leaf_offsets_[leaf_idx];
+    const uint32_t end = leaf_offsets_[leaf_idx + 1];
+    uint32_t found = UINT32_MAX;
+    bool undecided = false;
+    for (uint32_t idx = end; idx-- > begin;) {
+      const Containment c = classify(triangles_[idx], p.x(), p.y());
+      found = (c == Containment::inside) ? idx : found;
+      undecided = undecided || (c == Containment::undecided);
+    }
+    if (!undecided && found != UINT32_MAX) {
+      last_triangle_idx = found;
+      return triangles_.cbegin() + found;
+    }
 
-    for (const uint32_t idx : triangle_indices) {
+    for (uint32_t idx = begin; idx < end; ++idx) {
       if (contains(triangles_[idx])) {
-        last_locate_triangle_idx_ = idx;
+        last_triangle_idx = idx;
         return triangles_.cbegin() + idx;
       }
     }
@@ -178,91 +311,216 @@ public:
     return triangles_.cend();
   }
 
+  // Projected position of p, interpolated linearly in the triangle that
+  // contains p. The index of the last located triangle is kept by the
+  // caller, so this can be called from several threads.
+  [[nodiscard]] Point transform(const Point &p, uint32_t &last_triangle_idx)
+    const
+  {
+    const auto it = locate(p, last_triangle_idx);
+    return affine_maps_[static_cast<size_t>(it - triangles_.cbegin())].apply(
+      p);
+  }
+
+  // Transform all points in place. The points are visited in Morton order
+  // of their grid cells, so that consecutive points likely lie in the same
+  // leaf and the same triangle, and the visits are split among threads.
+  void transform(std::vector<Point> &pts) const
+  {
+    const auto n = pts.size();
+    std::vector<std::pair<uint64_t, size_t>> order(n);
+#pragma omp parallel for schedule(static) default(none) shared(pts, order, n)
+    for (size_t i = 0; i < n; ++i) {
+      auto cell = [](double v) {
+        return static_cast<uint32_t>(std::clamp(v, 0.0, double(UINT32_MAX)));
+      };
+      order[i] = {morton_code(cell(pts[i].x()), cell(pts[i].y())), i};
+    }
+    std::sort(order.begin(), order.end());
+
+    std::vector<Point> out(n);
+    const size_t n_chunks =
+      std::max<size_t>(1, std::min<size_t>(n_threads(), n));
+#pragma omp parallel for schedule(static, 1) default(none) \
+  shared(pts, order, out, n, n_chunks)
+    for (size_t c = 0; c < n_chunks; ++c) {
+      uint32_t last_triangle_idx = UINT32_MAX;
+      for (size_t k = n * c / n_chunks; k < n * (c + 1) / n_chunks; ++k) {
+        const size_t i = order[k].second;
+        out[i] = transform(pts[i], last_triangle_idx);
+      }
+    }
+    pts = std::move(out);
+  }
+
   [[nodiscard]] const std::vector<Triangle> &triangles() const
   {
     return triangles_;
   }
 
+  // Triangles of the leaf whose bottom-left corner is (x, y). (x, y) must
+  // be the bottom-left corner of a quadtree leaf, e.g. from
+  // qt_locator_->locate().
+  [[nodiscard]] std::span<const Triangle> leaf_triangles(
+    const uint32_t x,
+    const uint32_t y) const
+  {
+    const uint32_t key = proj_data_->offset(x, y);
+    assert(key < leaf_index_.size());
+    const uint32_t k = leaf_index_[key];
+    assert(k != UINT32_MAX);
+    return {
+      triangles_.data() + leaf_offsets_[k],
+      leaf_offsets_[k + 1] - leaf_offsets_[k]};
+  }
+
 private:
   const QuadtreeLocator *qt_locator_{};
   const Projection *proj_data_{};
 
   std::vector<Triangle> triangles_;
-  std::vector<std::vector<uint32_t>> leaf_to_triangle_idxs_;
+
+  // Compressed sparse row index from leaves to triangles. The triangles of a
+  // leaf are stored consecutively in triangles_, so the row of leaf k is the
+  // index range [leaf_offsets_[k], leaf_offsets_[k + 1]) and no separate
+  // array of triangle indices is needed. Leaves are numbered in the order of
+  // qt_locator_->leaves(), and leaf_index_ maps `proj_data_->offset(x, y)`
+  // of the bottom-left corner of a leaf to its number.
+  std::vector<uint32_t> leaf_offsets_;
+  std::vector<uint32_t> leaf_index_;
+
+  // affine_maps_[i] interpolates the projection linearly in triangles_[i]
+  std::vector<AffineMap> affine_maps_;
+
+  // Per-chunk triangle buffers used during build()
+  std::vector<std::vector<Triangle>> chunk_triangles_;
 
   mutable uint32_t last_locate_triangle_idx_{UINT32_MAX};
 
+  enum class Containment { outside, inside, undecided };
+
+  // Floating-point containment test of (px, py) in T. The edge vectors of T
+  // are small integers and thus exact, so each orientation determinant has
+  // an absolute error of at most 4u times the sum of the magnitudes of its
+  // two products, where u = 2^-53 is the unit roundoff. Determinants within
+  // that bound cannot be signed reliably and make the result undecided.
+  static Containment classify(const Triangle &T, double px, double py)
+  {
+    const auto &v = T.vertices;
+
+    // Orientation of the triangle itself, exactly in integer arithmetic
+    auto edge = [&](size_t from, size_t to) {
+      return std::array<int64_t, 2>{
+        int64_t{v[to].x()} - int64_t{v[from].x()},
+        int64_t{v[to].y()} - int64_t{v[from].y()}};
+    };
+    const auto e1 = edge(0, 1), e2 = edge(0, 2);
+    const int64_t turn = e1[0] * e2[1] - e1[1] * e2[0];
+    assert(turn != 0 && "Collinear triangles found in triangulation.");
+    const double sign = (turn > 0) ? 1.0 : -1.0;
+
+    // p is outside if it is strictly on the wrong side of any edge, and
+    // inside if it is strictly on the right side of all edges
+    constexpr double err_bound = 2.0 * std::numeric_limits<double>::epsilon();
+    bool outside = false, undecided = false;
+    for (size_t e = 0; e < 3; ++e) {
+      const QuadtreeCorner &a = v[e];
+      const QuadtreeCorner &b = v[(e + 1) % 3];
+      const double l = (double(b.x()) - double(a.x())) * (py - double(a.y()));
+      const double r = (double(b.y()) - double(a.y())) * (px - double(a.x()));
+      const double det = sign * (l - r);
+      const bool certain =
+        std::abs(det) > err_bound * (std::abs(l) + std::abs(r));
+      outside = outside || (certain && det < 0.0);
+      undecided = undecided || !certain;
+    }
+    return outside     ? Containment::outside
+           : undecided ? Containment::undecided
+                       : Containment::inside;
+  }
+
   void clear()
   {
     triangles_.clear();
-    leaf_to_triangle_idxs_.clear();
+    leaf_offsets_.clear();
+    leaf_index_.clear();
+    affine_maps_.clear();
     last_locate_triangle_idx_ = UINT32_MAX;
   }
 
-  // `leaf_pts` are the original-space vertices (integral values given by
-  // x(), y()) and `leaf_pts_proj` are the projected-space vertices (floating
-  // value given by x(), y()). The `leaf_x` and `leaf_y`
-  // are the coordinates of the leaf in the quadtree. Later we store the
-  // triangles in the `triangles_` vector and the indices of the triangles in
-  // the `leaf_to_triangle_idxs_` vector, where the key is the offset of the
-  // leaf in the projection data (which can be accessed via
-  // `proj_data_->offset(leaf_x, leaf_y)`)
+  // Solve for the affine map of each triangle, so that projecting a point
+  // costs six multiply-adds instead of a barycentric computation and three
+  // lookups of the projected vertices
+  void build_affine_maps()
+  {
+    affine_maps_.resize(triangles_.size());
+#pragma omp parallel for schedule(static) default(none)
+    for (size_t i = 0; i < triangles_.size(); ++i) {
+      const auto &v = triangles_[i].vertices;
+      const Point a = v[0], b = v[1], c = v[2];
+      const Point pa = proj_data_->get(v[0].x(), v[0].y());
+      const Point pb = proj_data_->get(v[1].x(), v[1].y());
+      const Point pc = proj_data_->get(v[2].x(), v[2].y());
+
+      // Edges from the first vertex in both spaces
+      const double e1x = b.x() - a.x(), e1y = b.y() - a.y();
+      const double e2x = c.x() - a.x(), e2y = c.y() - a.y();
+      const double f1x = pb.x() - pa.x(), f1y = pb.y() - pa.y();
+      const double f2x = pc.x() - pa.x(), f2y = pc.y() - pa.y();
+      const double det = e1x * e2y - e1y * e2x;
+
+      AffineMap &m = affine_maps_[i];
+      m.xx = (f1x * e2y - f2x * e1y) / det;
+      m.xy = (f2x * e1x - f1x * e2x) / det;
+      m.yx = (f1y * e2y - f2y * e1y) / det;
+      m.yy = (f2y * e1x - f1y * e2x) / det;
+      m.x0 = pa.x() - m.xx * a.x() - m.xy * a.y();
+      m.y0 = pa.y() - m.yx * a.x() - m.yy * a.y();
+    }
+  }
+
+  // Boundary point i of the leaf polygon given by config
+  static QuadtreeCorner corner(
+    const leaf_triangulation::Config &config,
+    uint32_t i,
+    uint32_t leaf_x,
+    uint32_t leaf_y,
+    uint32_t leaf_size)
+  {
+    const auto &p = leaf_triangulation::positions[config.position[i]];
+    return {leaf_x + p[0] * leaf_size / 2, leaf_y + p[1] * leaf_size / 2};
+  }
+
+  // `config` gives the original-space vertices of the leaf polygon (integral
+  // values) and `leaf_pts_proj` the projected-space vertices (floating
+  // values). `leaf_x`, `leaf_y` and `leaf_size` describe the leaf in the
+  // quadtree. The triangles are appended to `out`.
   bool triangulate_max_min_angle(
-    const std::vector<QuadtreeCorner> &leaf_pts,
-    const std::vector<Point> &leaf_pts_proj,
+    const leaf_triangulation::Config &config,
+    const std::array<Point, 8> &leaf_pts_proj,
     uint32_t leaf_x,
-    uint32_t leaf_y)
+    uint32_t leaf_y,
+    uint32_t leaf_size,
+    std::vector<Triangle> &out) const
   {
-    const uint32_t n = static_cast<uint32_t>(leaf_pts.size());
+    const uint32_t n = config.n;
 
     // Given that we are triangulating a square with possibly 0 to 4 midpoints
     // in addtion to the 4 corners, the following condition must be true
     assert(n >= 4 && n <= 8);
 
-    // Sanity check
-    assert(leaf_pts_proj.size() == n);
-
-    auto angle_at =
-      [&](const Point &p, const Point &q, const Point &r) -> double {
-      const double ux = p.x() - q.x(), uy = p.y() - q.y();
-      const double vx = r.x() - q.x(), vy = r.y() - q.y();
-      return std::atan2(
-        std::abs(ux * vy - uy * vx),
-        ux * vx + uy * vy);  // in [0, π]
-    };
-
-    auto compute_min_angle =
-      [&](const Point &a, const Point &b, const Point &c) {
-        const double a0 = angle_at(b, a, c);
-        const double a1 = angle_at(a, b, c);
-        const double a2 = angle_at(a, c, b);
-        return std::min({a0, a1, a2});
-      };
-
-    // Since the coordinates are all integral, we can do the check directly
-    // without worrying about floating point precision issues
-    auto axis_colinear = [](
-                           const QuadtreeCorner &a,
-                           const QuadtreeCorner &b,
-                           const QuadtreeCorner &c) -> bool {
-      const auto ax = a.x(), ay = a.y();
-      const auto bx = b.x(), by = b.y();
-      const auto cx = c.x(), cy = c.y();
-      return (ax == bx && bx == cx) || (ay == by && by == cy);
-    };
-
     // Here we use dynamic programming to find the triangulation that maximizes
-    // the minimum angle in the projected space
+    // the minimum angle in the projected space. Angles are compared through
+    // leaf_triangulation::min_angle_key().
 
-    // DP: dp[i][j] = best achievable minimal angle (radians) on chain i..j
-    // (i<j)
-    std::vector<std::vector<double>> dp(n, std::vector<double>(n, 0.0));
+    // DP: dp[i][j] = best achievable minimal angle key on chain i..j (i<j)
+    std::array<std::array<double, 8>, 8> dp{};
 
     // For each final value of chain i..j in dp[i][j], cut[i][j] where should
     // the chain be cut at k, so that min(dp[i][k], min_angle(i, k, j),
     // dp[k][j]) = dp[i][j]
     // This is useful to construct the triangulation later
-    std::vector<std::vector<int>> cut(n, std::vector<int>(n, -1));
+    std::array<std::array<int8_t, 8>, 8> cut{};
 
     // Base case with triangle with two points
     for (size_t i = 0; i + 1 < n; ++i)
@@ -274,24 +532,27 @@ private:
 
         // Now need to find the best "cut" k that will maximize dp[i][j]
         // Notice that values dp[i][k], and dp[k][j] are already computed
-        // previously
+        // previously. Cuts that give no proper triangle are not candidates.
         double best = 0.0;
-        int bestk = -1;
+        int8_t bestk = -1;
+        const unsigned int candidates = config.candidates[i][j];
         for (size_t k = i + 1; k <= j - 1; ++k) {
-
-          // We do not want to consider triangles that are not triangles at all
-          if (axis_colinear(leaf_pts[i], leaf_pts[k], leaf_pts[j]))
+          if (((candidates >> k) & 1u) == 0)
             continue;
 
-          const double min_proj_angle = compute_min_angle(
+          const double min_proj_angle = leaf_triangulation::min_angle_key(
             leaf_pts_proj[i],
             leaf_pts_proj[k],
             leaf_pts_proj[j]);
 
+          // The keys are squared sines, so the absolute tolerance of
+          // less_than() would reject angles below about 1e-4 rad. Keys are
+          // therefore compared exactly. A key of zero (degenerate triangle)
+          // never becomes a cut.
           const double cand = std::min({dp[i][k], dp[k][j], min_proj_angle});
-          if (less_than(best, cand)) {
+          if (cand > best) {
             best = cand;
-            bestk = static_cast<int>(k);
+            bestk = static_cast<int8_t>(k);
           }
         }
 
@@ -300,21 +561,31 @@ private:
       }
     }
 
-    // Reconstruct triangles for the optimal solution at (dp[0][n-1])
-
+    // Reconstruct triangles for the optimal solution at (dp[0][n-1]) in the
+    // same order as a pre-order traversal of the cuts
     bool okay =
       true;  // If any triangle flips in the projected space, we return false
-    size_t leaf_offset = proj_data_->offset(leaf_x, leaf_y);
-    auto construct = [&](auto &&self, size_t i, size_t j) -> void {
+
+    // A polygon with n points has n - 2 triangles, so at most six chains
+    // are pending at any time
+    std::array<std::array<uint8_t, 2>, 8> chains;
+    size_t n_chains = 0;
+    chains[n_chains++] = {0, static_cast<uint8_t>(n - 1)};
+    while (n_chains > 0) {
+      const auto [i, j] = chains[--n_chains];
       if (j <= i + 1)
-        return;
-      assert(cut[i][j] >= 0);
-      size_t k = static_cast<size_t>(cut[i][j]);
-
-      CGAL::Orientation orien_ori = CGAL::orientation(
-        Point(leaf_pts[i]),
-        Point(leaf_pts[k]),
-        Point(leaf_pts[j]));
+        continue;
+      // No proper triangle on the chain i..j in the projected space
+      if (cut[i][j] < 0) {
+        return false;
+      }
+      const auto k = static_cast<uint8_t>(cut[i][j]);
+      const QuadtreeCorner ci = corner(config, i, leaf_x, leaf_y, leaf_size);
+      const QuadtreeCorner ck = corner(config, k, leaf_x, leaf_y, leaf_size);
+      const QuadtreeCorner cj = corner(config, j, leaf_x, leaf_y, leaf_size);
+
+      CGAL::Orientation orien_ori =
+        CGAL::orientation(Point(ci), Point(ck), Point(cj));
       CGAL::Orientation orien_proj = CGAL::orientation(
         leaf_pts_proj[i],
         leaf_pts_proj[k],
@@ -325,16 +596,12 @@ private:
         okay = false;
       }
 
-      Triangle T{{leaf_pts[i], leaf_pts[k], leaf_pts[j]}};
-      const uint32_t triangle_idx = static_cast<uint32_t>(triangles_.size());
-      triangles_.push_back(T);
-      leaf_to_triangle_idxs_[leaf_offset].push_back(triangle_idx);
+      out.push_back(Triangle{{ci, ck, cj}});
 
-      self(self, i, static_cast<uint32_t>(k));
-      self(self, static_cast<uint32_t>(k), j);
-    };
-
-    construct(construct, 0, n - 1);
+      // Visit chain i..k before chain k..j
+      chains[n_chains++] = {k, j};
+      chains[n_chains++] = {i, k};
+    }
     return okay;
   }
 };
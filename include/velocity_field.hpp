@@ -0,0 +1,135 @@
+#ifndef VELOCITY_FIELD_HPP_
+#define VELOCITY_FIELD_HPP_
+
+#include "cgal_typedef.hpp"
+#include "ft_real_2d.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Velocity field v = -flux / rho of the diffusion integrator, where
+// rho(t) = rho_mean + (1 - t) * (rho_init - rho_mean) is linear in t.
+// The flux and rho grids are stored once per integration in a single
+// interleaved grid of nodes, so that the velocity at any point and any time
+// needs four contiguous node loads instead of eight lookups into four
+// separate grids.
+//
+// The grid is padded by one node on each side. Node a = 0 lies on x = 0,
+// node a = lx + 1 lies on x = lx and node a = k + 1 lies at the centre of
+// grid cell k (similarly for y). On boundary nodes, the velocity component
+// normal to the boundary is zero and the tangential component is copied from
+// the adjacent cell. Hence, velocity() returns the same values as
+// interpolate_bilinearly() applied to the velocity at the cell centres.
+class VelocityField
+{
+private:
+  struct alignas(32) Node {
+    double neg_flux_x, neg_flux_y, drho;
+    double padding;
+  };
+
+  std::vector<Node> nodes_;
+  unsigned int lx_ = 0, ly_ = 0;  // Lattice dimensions
+  double rho_mean_ = 0.0;
+
+  const Node &node(const size_t a, const size_t b) const
+  {
+    return nodes_[a * (ly_ + 2) + b];
+  }
+
+public:
+  // Fill the node grid. The flux grids must already have been transformed
+  // to real space. rho_ft(0, 0) is the mean density. The flux and rho_ft
+  // grids are in single precision if --fp32_spectral is used.
+  template <typename T>
+  void build(
+    const BasicFTReal2d<T> &grid_fluxx_init,
+    const BasicFTReal2d<T> &grid_fluxy_init,
+    const FTReal2d &rho_init,
+    const BasicFTReal2d<T> &rho_ft,
+    unsigned int lx,
+    unsigned int ly);
+
+  // Velocity at position (x, y) at time t. The position must be inside
+  // [0, lx] x [0, ly].
+  Vector velocity(const double x, const double y, const double t) const
+  {
+    double vx, vy;
+    interpolate(x, y, 1.0 - t, vx, vy);
+    return {vx, vy};
+  }
+
+  // Batched version of velocity() for n positions (x[k], y[k]). The loop has
+  // no data-dependent branches, so that the compiler can vectorise it with
+  // gathers for the node loads. Instead of failing on positions outside
+  // [0, lx] x [0, ly], in_domain[k] is set to 0 and (vx[k], vy[k]) is the
+  // velocity at the nearest position inside the domain. Otherwise,
+  // in_domain[k] is set to 1.
+  void velocities(
+    const double *x,
+    const double *y,
+    const size_t n,
+    const double t,
+    double *vx,
+    double *vy,
+    unsigned char *in_domain) const
+  {
+    const double dlx = lx_;
+    const double dly = ly_;
+    const double s = 1.0 - t;
+#pragma omp simd
+    for (size_t k = 0; k < n; ++k) {
+      const bool inside =
+        (x[k] >= 0.0 && x[k] <= dlx && y[k] >= 0.0 && y[k] <= dly);
+
+      // std::max(0.0, NaN) is 0.0, so NaN positions are also clamped
+      const double xc = std::min(dlx, std::max(0.0, x[k]));
+      const double yc = std::min(dly, std::max(0.0, y[k]));
+      interpolate(xc, yc, s, vx[k], vy[k]);
+      in_domain[k] = inside ? 1 : 0;
+    }
+  }
+
+private:
+  // Bilinear interpolation of the velocity at (x, y), where s = 1 - t
+  void interpolate(
+    const double x,
+    const double y,
+    const double s,
+    double &vx,
+    double &vy) const
+  {
+    // Indices of the nodes to the left and to the right of x
+    const double fx = std::floor(x + 0.5);
+    const double fy = std::floor(y + 0.5);
+    const auto a0 = static_cast<size_t>(fx);
+    const auto b0 = static_cast<size_t>(fy);
+
+    // Node positions, clamped to the boundary for the padding nodes
+    const double x0 = std::max(0.0, fx - 0.5);
+    const double x1 = std::min(static_cast<double>(lx_), fx + 0.5);
+    const double y0 = std::max(0.0, fy - 0.5);
+    const double y1 = std::min(static_cast<double>(ly_), fy + 0.5);
+    const double delta_x = (x - x0) / (x1 - x0);
+    const double delta_y = (y - y0) / (y1 - y0);
+
+    const double w00 = (1.0 - delta_x) * (1.0 - delta_y);
+    const double w01 = (1.0 - delta_x) * delta_y;
+    const double w10 = delta_x * (1.0 - delta_y);
+    const double w11 = delta_x * delta_y;
+    const Node &n00 = node(a0, b0);
+    const Node &n01 = node(a0, b0 + 1);
+    const Node &n10 = node(a0 + 1, b0);
+    const Node &n11 = node(a0 + 1, b0 + 1);
+    const double rho00 = rho_mean_ + s * n00.drho;
+    const double rho01 = rho_mean_ + s * n01.drho;
+    const double rho10 = rho_mean_ + s * n10.drho;
+    const double rho11 = rho_mean_ + s * n11.drho;
+    vx = w00 * (n00.neg_flux_x / rho00) + w01 * (n01.neg_flux_x / rho01) +
+         w10 * (n10.neg_flux_x / rho10) + w11 * (n11.neg_flux_x / rho11);
+    vy = w00 * (n00.neg_flux_y / rho00) + w01 * (n01.neg_flux_y / rho01) +
+         w10 * (n10.neg_flux_y / rho10) + w11 * (n11.neg_flux_y / rho11);
+  }
+};
+
+#endif  // VELOCITY_FIELD_HPP_
@@ -197,10 +197,10 @@ void CartogramInfo::replace_missing_and_zero_target_areas()
   double total_start_area_with_data = 0.0;
   double total_target_area_with_data = 0.0;
   for (const InsetState &inset_state : inset_states_) {
-    for (const auto &gd : inset_state.geo_divs()) {
-      if (!inset_state.target_area_is_missing(gd.id())) {
-        total_start_area_with_data += gd.area();
-        total_target_area_with_data += inset_state.target_area_at(gd.id());
+    for (uint32_t i = 0; i < inset_state.n_geo_divs(); ++i) {
+      if (!inset_state.target_area_is_missing(i)) {
+        total_start_area_with_data += inset_state.geo_divs()[i].area();
+        total_target_area_with_data += inset_state.target_area_at(i);
       }
     }
   }
@@ -263,10 +263,11 @@ void CartogramInfo::replace_missing_and_zero_target_areas()
 
     // Replace the small target areas
     for (InsetState &inset_state : inset_states_) {
-      for (const auto &gd : inset_state.geo_divs()) {
+      for (uint32_t i = 0; i < inset_state.n_geo_divs(); ++i) {
+        const GeoDiv &gd = inset_state.geo_divs()[i];
 
         // Current target area
-        const double target_area = inset_state.target_area_at(gd.id());
+        const double target_area = inset_state.target_area_at(i);
         if (
           (target_area >= 0.0) &&
           (target_area <= small_target_area_threshold)) {
@@ -277,7 +278,7 @@ void CartogramInfo::replace_missing_and_zero_target_areas()
             std::min(replacement_target_area, gd.area() * mean_density),
             target_area);
           inset_state.replace_target_area(
-            gd.id(),
+            i,
             gd_specific_replacement_target_area);
           std::cerr << gd.id() << ": " << target_area << " to "
                     << gd_specific_replacement_target_area
@@ -296,8 +297,9 @@ void CartogramInfo::replace_missing_and_zero_target_areas()
 
     // Assign new target areas to GeoDivs
     for (InsetState &inset_state : inset_states_) {
-      for (const auto &gd : inset_state.geo_divs()) {
-        if (inset_state.target_area_is_missing(gd.id())) {
+      for (uint32_t i = 0; i < inset_state.n_geo_divs(); ++i) {
+        const GeoDiv &gd = inset_state.geo_divs()[i];
+        if (inset_state.target_area_is_missing(i)) {
           double new_target_area;
 
           // If all target areas are missing, make all GeoDivs equal to their
@@ -311,7 +313,7 @@ void CartogramInfo::replace_missing_and_zero_target_areas()
               total_target_area_with_data / total_start_area_with_data;
             new_target_area = adjusted_mean_density * gd.area();
           }
-          inset_state.replace_target_area(gd.id(), new_target_area);
+          inset_state.replace_target_area(i, new_target_area);
         }
       }
     }
@@ -129,8 +129,9 @@ inline void write_labels(Canvas &cvs, InsetState &inset_state)
 {
   cvs.set_stroke(Color{0, 0, 0}, 1.0);  // black text
 
-  for (const auto &gd : inset_state.geo_divs()) {
-    std::string label = inset_state.label_at(gd.id());
+  for (uint32_t i = 0; i < inset_state.n_geo_divs(); ++i) {
+    const GeoDiv &gd = inset_state.geo_divs()[i];
+    const std::string &label = inset_state.label_at(i);
     Point pt = gd.point_on_surface_of_geodiv();
 
     double fsize = choose_font_size(label, pt, gd, inset_state);
@@ -221,10 +222,11 @@ inline void write_polygons(
 
   cvs.set_stroke(outline, line_w);
 
-  for (const auto &gd : inset_state.geo_divs()) {
+  for (uint32_t i = 0; i < inset_state.n_geo_divs(); ++i) {
+    const GeoDiv &gd = inset_state.geo_divs()[i];
     Color fill = outline;
     if (colours) {
-      auto c = inset_state.color_at(gd.id());
+      auto c = inset_state.color_at(i);
       fill = Color(c.r / 255.0, c.g / 255.0, c.b / 255.0);
     } else if (fill_polygons) {
       fill = Color{0.96, 0.92, 0.70};
@@ -252,8 +254,9 @@ inline void write_polygons(
   }
 
   cvs.set_stroke(Color{0, 0, 0}, 1.0);
-  for (const auto &gd : inset_state.geo_divs()) {
-    auto lbl = inset_state.label_at(gd.id());
+  for (uint32_t i = 0; i < inset_state.n_geo_divs(); ++i) {
+    const GeoDiv &gd = inset_state.geo_divs()[i];
+    const std::string &lbl = inset_state.label_at(i);
     Point pt = gd.point_on_surface_of_geodiv();
     double fs = choose_font_size(lbl, pt, gd, inset_state);
     if (fs > 0)
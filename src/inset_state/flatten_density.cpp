@@ -1,6 +1,14 @@
 #include "constants.hpp"
 #include "inset_state.hpp"
-#include "interpolate_bilinearly.hpp"
+#include <array>
+
+// Positions and velocities of a block of quadtree corners, laid out so that
+// VelocityField::velocities() can interpolate the whole block at once
+struct CornerBlock {
+  static constexpr size_t size = 256;
+  std::array<double, size> x, y, vx, vy;
+  std::array<unsigned char, size> in_domain;
+};
 
 bool InsetState::flatten_density()
 {
@@ -24,49 +32,6 @@ bool InsetState::flatten_density()
   return true;
 }
 
-static bool all_map_points_are_in_domain(
-  const double delta_t,
-  const std::vector<Point> &projection,
-  const std::vector<Vector> &velocity,
-  const unsigned int lx,
-  const unsigned int ly)
-{
-  // Return false if and only if there exists a point that would be outside
-  // [0, lx] x [0, ly]
-  for (size_t i = 0; i < projection.size(); i++) {
-    const auto &pos = projection[i];
-    const auto &velo = velocity[i];
-    double x = pos.x() + 0.5 * delta_t * velo.x();
-    double y = pos.y() + 0.5 * delta_t * velo.y();
-
-    // if close to 0 using EPS, make 0, or greater than lx or ly, make lx or ly
-    if (abs(x) < dbl_epsilon || abs(x - lx) < dbl_epsilon)
-      x = (abs(x) < dbl_epsilon) ? 0 : lx;
-    if (abs(y) < dbl_epsilon || abs(y - ly) < dbl_epsilon)
-      y = (abs(y) < dbl_epsilon) ? 0 : ly;
-
-    if (x < 0.0 || x > lx || y < 0.0 || y > ly) {
-      return false;
-    }
-  }
-  return true;
-}
-
-static inline double calculate_velocity_for_point(
-  unsigned int i,
-  unsigned int j,
-  char direction,
-  double t,
-  const FTReal2d &grid_fluxx_init,
-  const FTReal2d &grid_fluxy_init,
-  const FTReal2d &rho_ft,
-  const FTReal2d &rho_init)
-{
-  double rho = rho_ft(0, 0) + (1.0 - t) * (rho_init(i, j) - rho_ft(0, 0));
-  return (direction == 'x') ? (-grid_fluxx_init(i, j) / rho)
-                            : (-grid_fluxy_init(i, j) / rho);
-}
-
 bool InsetState::flatten_density_on_node_vertices()
 {
   timer.start("Flatten Density");
@@ -88,59 +53,48 @@ bool InsetState::flatten_density_on_node_vertices()
     projection[i] = unique_quadtree_corners_[i];
   }
 
-  // eul[(i, j)] will be the new position of
-  // proj_qd_.triangle_transformation[(i, j)] proposed by a simple Euler step:
-  // move a full time interval delta_t with the velocity at time t and position
-  // (proj_qd_.triangle_transformation[(i, j)].x,
-  // proj_qd_.triangle_transformation[(i, j)].y)
-  std::vector<Point> eul(num_quadtree_corners);
-
-  // mid[(i, j)] will be the new displacement proposed by the midpoint
-  // method (see comment below for the formula)
-  std::vector<Point> mid(num_quadtree_corners);
-
-  // v_intp[(i, j)] will be the velocity at position
-  // (proj_qd_.triangle_transformation[(i, j)].x,
-  // proj_qd_.triangle_transformation[(i, j)].y) at time t
-  std::vector<Vector> v_intp(num_quadtree_corners);
-
-  // We must typecast lx_ and ly_ as double-precision numbers. Otherwise, the
-  // ratios in the denominator will evaluate as zero.
+  // v_intp[i] will be the velocity at position projection[i] at time t.
+  // mid[i] will be the new position of projection[i] proposed by the
+  // midpoint method (see comment below for the formula). Both buffers are
+  // reused between integrations, so resize() only allocates when the number
+  // of quadtree corners grows.
+  std::vector<Vector> &v_intp = integration_ws_.v_intp;
+  std::vector<Point> &mid = integration_ws_.mid;
+  v_intp.resize(num_quadtree_corners);
+  mid.resize(num_quadtree_corners);
+
+  // Lattice dimensions as double-precision numbers
   double dlx = lx_;
   double dly = ly_;
 
-  // We temporarily insert the Fourier coefficients for the x-components and
-  // y-components of the flux vector into grid_fluxx_init and grid_fluxy_init
-  // The reason for +1 in di+1 stems from the RODFT10 formula at:
-  // https://www.fftw.org/fftw3_doc/1d-Real_002dodd-DFTs-_0028DSTs_0029.html
-#pragma omp parallel for default(none) shared(dlx, dly)
-  for (unsigned int i = 0; i < lx_ - 1; ++i) {
-    const double di = i;
-    for (unsigned int j = 0; j < ly_; ++j) {
-      const double denom =
-        pi * ((di + 1) / dlx + (j / (di + 1)) * (j / dly) * (dlx / dly));
-      grid_fluxx_init_(i, j) = -rho_ft_(i + 1, j) / denom;
-    }
-  }
-  for (unsigned int j = 0; j < ly_; ++j) {
-    grid_fluxx_init_(lx_ - 1, j) = 0.0;
-  }
-#pragma omp parallel for default(none) shared(dlx, dly)
-  for (unsigned int i = 0; i < lx_; ++i) {
-    const double di = i;
-    for (unsigned int j = 0; j < ly_ - 1; ++j) {
-      const double denom =
-        pi * ((di / (j + 1)) * (di / dlx) * (dly / dlx) + (j + 1) / dly);
-      grid_fluxy_init_(i, j) = -rho_ft_(i, j + 1) / denom;
-    }
-  }
-  for (unsigned int i = 0; i < lx_; ++i) {
-    grid_fluxy_init_(i, ly_ - 1) = 0.0;
+  // blur_density() has stored the Fourier coefficients of the flux in
+  // grid_fluxx_init and grid_fluxy_init. Transform them to the flux vector.
+  execute_fftw_plans_for_flux();
+
+  // Interleave flux and density so that the velocity at any time can be
+  // interpolated from a single grid
+  if (fp32_spectral_) {
+    integration_ws_.velocity_field.build(
+      grid_fluxx_init_f_,
+      grid_fluxy_init_f_,
+      rho_init_,
+      rho_ft_f_,
+      lx_,
+      ly_);
+  } else {
+    integration_ws_.velocity_field.build(
+      grid_fluxx_init_,
+      grid_fluxy_init_,
+      rho_init_,
+      rho_ft_,
+      lx_,
+      ly_);
   }
+  const VelocityField &velocity_field = integration_ws_.velocity_field;
 
-  // Compute the flux vector and store the result in grid_fluxx_init and
-  // grid_fluxy_init
-  execute_fftw_plans_for_flux();
+  // Corners are advected in blocks of CornerBlock::size
+  const size_t n_blocks =
+    (num_quadtree_corners + CornerBlock::size - 1) / CornerBlock::size;
 
   double t = 0.0;
   double delta_t = 0.30;  // Initial time step.
@@ -150,124 +104,115 @@ bool InsetState::flatten_density_on_node_vertices()
   // Integrate
   while (t < 1.0 && iter <= max_iter) {
 
-    // calculate_velocity lambda function
-    auto cal_velocity_at_current_time =
-      [&](unsigned int i, unsigned int j, char direction) {
-        return calculate_velocity_for_point(
-          i,
-          j,
-          direction,
-          t,
-          grid_fluxx_init_,
-          grid_fluxy_init_,
-          rho_ft_,
-          rho_init_);
-      };
-
-    for (size_t i = 0; i < num_quadtree_corners; ++i) {
-      const auto &pos = projection[i];
-
-      // We know, either because of the initialization or because of the
-      // check at the end of the last iteration, that
-      // proj_qd_.triangle_transformation[(i, j)] is inside the rectangle
-      // [0, lx_] x [0, ly_]. This fact guarantees that
-      // interpolate_bilinearly() is given a point that cannot cause it to
-      // fail.
-      Vector v_intp_val(
-        interpolate_bilinearly(
-          pos.x(),
-          pos.y(),
-          cal_velocity_at_current_time,
-          'x',
-          lx_,
-          ly_),
-        interpolate_bilinearly(
-          pos.x(),
-          pos.y(),
-          cal_velocity_at_current_time,
-          'y',
-          lx_,
-          ly_));
-      v_intp[i] = v_intp_val;
+    // We know, either because of the initialization or because of the
+    // check at the end of the last iteration, that projection[i] is inside
+    // the rectangle [0, lx_] x [0, ly_]. This fact guarantees that
+    // velocity_field is given a point inside its domain.
+#pragma omp parallel for schedule(static)
+    for (size_t blk = 0; blk < n_blocks; ++blk) {
+      const size_t begin = blk * CornerBlock::size;
+      const size_t n =
+        std::min(CornerBlock::size, num_quadtree_corners - begin);
+      CornerBlock cb;
+      for (size_t k = 0; k < n; ++k) {
+        cb.x[k] = projection[begin + k].x();
+        cb.y[k] = projection[begin + k].y();
+      }
+      velocity_field.velocities(
+        cb.x.data(),
+        cb.y.data(),
+        n,
+        t,
+        cb.vx.data(),
+        cb.vy.data(),
+        cb.in_domain.data());
+      for (size_t k = 0; k < n; ++k) {
+        v_intp[begin + k] = Vector(cb.vx[k], cb.vy[k]);
+      }
     }
 
     bool accept = false;
     while (!accept) {
 
-      // Simple Euler step.
-      for (size_t i = 0; i < num_quadtree_corners; ++i) {
-        const auto &pos = projection[i];
-        Point eul_val(
-          pos.x() + v_intp[i].x() * delta_t,
-          pos.y() + v_intp[i].y() * delta_t);
-        eul[i] = eul_val;
-      }
-
       // Use "explicit midpoint method"
       // x <- x + delta_t * v_x(x + 0.5 * delta_t * v_x(x, y, t),
       //                        y + 0.5 * delta_t *v_y(x, y, t),
       //                        t + 0.5 * delta_t)
       // and similarly for y.
-      auto cal_velocity_at_mid_time =
-        [&](unsigned int i, unsigned int j, char direction) {
-          return calculate_velocity_for_point(
-            i,
-            j,
-            direction,
-            t + 0.5 * delta_t,
-            grid_fluxx_init_,
-            grid_fluxy_init_,
-            rho_ft_,
-            rho_init_);
-        };
-
-      // Make sure we do not pass a point outside [0, lx_] x [0, ly_] to
-      // interpolate_bilinearly(). Otherwise, decrease the time step below and
-      // try again.
-      accept =
-        all_map_points_are_in_domain(delta_t, projection, v_intp, lx_, ly_);
-
-      if (accept) {
-
-        // Okay, we can run interpolate_bilinearly()
-        for (size_t i = 0; i < num_quadtree_corners; ++i) {
-          const auto &pos = projection[i];
-          const auto &velo = v_intp[i];
-
-          // v_intp_half[(i, j)] will be the velocity at the midpoint
-          // (proj_qd_.triangle_transformation[(i, j)].x + 0.5 * delta_t *
-          // v_intp[(i, j)].x, proj_qd_.triangle_transformation[(i, j)].y + 0.5
-          // * delta_t * v_intp[(i, j)].y) at time t + 0.5 * delta_t
-          Vector v_intp_half_val(
-            interpolate_bilinearly(
-              pos.x() + 0.5 * delta_t * velo.x(),
-              pos.y() + 0.5 * delta_t * velo.y(),
-              cal_velocity_at_mid_time,
-              'x',
-              lx_,
-              ly_),
-            interpolate_bilinearly(
-              pos.x() + 0.5 * delta_t * velo.x(),
-              pos.y() + 0.5 * delta_t * velo.y(),
-              cal_velocity_at_mid_time,
-              'y',
-              lx_,
-              ly_));
-
-          mid[i] = Point(
-            pos.x() + v_intp_half_val.x() * delta_t,
-            pos.y() + v_intp_half_val.y() * delta_t);
-
-          // Do not accept the integration step if the maximum squared
-          // difference between the Euler and midpoint proposals exceeds
-          // abs_tol. Neither should we accept the integration step if one
-          // of the positions wandered out of the domain. If one of these
-          // problems occurred, decrease the time step.
-          const double sq_dist = CGAL::squared_distance(mid[i], eul[i]);
+
+      // For each corner, compute the Euler and midpoint proposals in a single
+      // pass. Do not accept the integration step if the squared difference
+      // between the two proposals exceeds abs_tol for any corner. Neither
+      // should we accept the integration step if a midpoint or one of the new
+      // positions wandered out of the domain. Once a thread has found a
+      // rejected corner, it skips the rest of its share of the blocks
+      // because the step will be retried anyway.
+      accept = true;
+#pragma omp parallel for schedule(static) reduction(&& : accept)
+      for (size_t blk = 0; blk < n_blocks; ++blk) {
+        if (!accept) {
+          continue;
+        }
+        const size_t begin = blk * CornerBlock::size;
+        const size_t n =
+          std::min(CornerBlock::size, num_quadtree_corners - begin);
+        CornerBlock cb;
+        for (size_t k = 0; k < n; ++k) {
+          const auto &pos = projection[begin + k];
+          const auto &velo = v_intp[begin + k];
+
+          // Position at which the velocity at time t + 0.5 * delta_t is
+          // needed. If close to the boundary using dbl_epsilon, snap it onto
+          // the boundary.
+          double x_half = pos.x() + 0.5 * delta_t * velo.x();
+          double y_half = pos.y() + 0.5 * delta_t * velo.y();
+          if (std::abs(x_half) < dbl_epsilon) {
+            x_half = std::max(x_half, 0.0);
+          } else if (std::abs(x_half - dlx) < dbl_epsilon) {
+            x_half = std::min(x_half, dlx);
+          }
+          if (std::abs(y_half) < dbl_epsilon) {
+            y_half = std::max(y_half, 0.0);
+          } else if (std::abs(y_half - dly) < dbl_epsilon) {
+            y_half = std::min(y_half, dly);
+          }
+          cb.x[k] = x_half;
+          cb.y[k] = y_half;
+        }
+        velocity_field.velocities(
+          cb.x.data(),
+          cb.y.data(),
+          n,
+          t + 0.5 * delta_t,
+          cb.vx.data(),
+          cb.vy.data(),
+          cb.in_domain.data());
+        for (size_t k = 0; k < n; ++k) {
+
+          // If the midpoint is outside [0, lx_] x [0, ly_], decrease the
+          // time step below and try again
+          if (!cb.in_domain[k]) {
+            accept = false;
+            break;
+          }
+          const auto &pos = projection[begin + k];
+          const auto &velo = v_intp[begin + k];
+
+          // Simple Euler step: move a full time interval delta_t with the
+          // velocity at time t
+          const Point eul(
+            pos.x() + velo.x() * delta_t,
+            pos.y() + velo.y() * delta_t);
+          const Point mid_val(
+            pos.x() + cb.vx[k] * delta_t,
+            pos.y() + cb.vy[k] * delta_t);
+          mid[begin + k] = mid_val;
+          const double sq_dist = CGAL::squared_distance(mid_val, eul);
           if (
-            sq_dist > abs_tol || mid[i].x() < 0.0 || mid[i].x() > lx_ ||
-            mid[i].y() < 0.0 || mid[i].y() > ly_) {
+            sq_dist > abs_tol || mid_val.x() < 0.0 || mid_val.x() > dlx ||
+            mid_val.y() < 0.0 || mid_val.y() > dly) {
             accept = false;
+            break;
           }
         }
       }
@@ -292,7 +237,8 @@ bool InsetState::flatten_density_on_node_vertices()
     t += delta_t;
     ++iter;
 
-    // Update the triangle transformation map
+    // Update the triangle transformation map. Swapping keeps both buffers
+    // allocated for the next time step and the next integration.
     std::swap(projection, mid);
 
     delta_t *= inc_after_acc;  // Try a larger step next time
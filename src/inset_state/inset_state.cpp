@@ -1,9 +1,12 @@
 #include "inset_state.hpp"
 #include "constants.hpp"
 #include "csv.hpp"
+#include "fftw_planner.hpp"
 #include "quadtree.hpp"
 #include "triangulation.hpp"
 #include <algorithm>
+#include <cmath>
+#include <limits>
 
 InsetState::InsetState(std::string pos, Arguments args)
     : args_(args), pos_(pos)
@@ -20,14 +23,12 @@ InsetState::InsetState(std::string pos, Arguments args)
 
 double InsetState::area_error_at(const std::string &id) const
 {
-  try {
-    return area_errors_.at(id);
-  } catch (const std::out_of_range &e) {
-    std::cerr << "ERROR: Key '" << id << "' not found in area_errors_. "
-              << "Exception: " << e.what() << std::endl;
-    // Re-throw, or return a default value
-    throw;
-  }
+  return area_errors_[geo_div_index(id)];
+}
+
+double InsetState::area_error_at(const uint32_t gd_index) const
+{
+  return area_errors_[gd_index];
 }
 
 Bbox InsetState::bbox(bool original_bbox) const
@@ -38,11 +39,14 @@ Bbox InsetState::bbox(bool original_bbox) const
   double inset_xmax = -dbl_inf;
   double inset_ymin = dbl_inf;
   double inset_ymax = -dbl_inf;
+
+  // Minimum and maximum do not depend on the order of evaluation, so the
+  // result is the same for any number of threads
 #pragma omp parallel for default(none) shared(geo_divs) \
   reduction(min : inset_xmin, inset_ymin)               \
   reduction(max : inset_xmax, inset_ymax)
-  for (const auto &gd : geo_divs) {
-    for (const auto &pwh : gd.polygons_with_holes()) {
+  for (size_t i = 0; i < geo_divs.size(); ++i) {
+    for (const auto &pwh : geo_divs[i].polygons_with_holes()) {
       const auto bb = pwh.bbox();
       inset_xmin = std::min(bb.xmin(), inset_xmin);
       inset_ymin = std::min(bb.ymin(), inset_ymin);
@@ -86,24 +90,33 @@ double InsetState::blur_width() const
 
 Color InsetState::color_at(const std::string &id) const
 {
-  try {
-    return colors_.at(id);
-  } catch (const std::out_of_range &e) {
-    std::cerr << "ERROR: Key '" << id << "' not found in colors_. "
-              << "Exception: " << e.what() << std::endl;
-    // Re-throw, or return a default value
-    throw;
+  return color_at(geo_div_index(id));
+}
+
+Color InsetState::color_at(const uint32_t gd_index) const
+{
+  if (!colors_[gd_index]) {
+    std::cerr << "ERROR: GeoDiv '" << geo_divs_[gd_index].id()
+              << "' has no color." << std::endl;
+    throw std::out_of_range("GeoDiv has no color");
   }
+  return *colors_[gd_index];
 }
 
 bool InsetState::color_found(const std::string &id) const
 {
-  return colors_.count(id);
+  const auto it = geo_divs_id_to_index_.find(id);
+  return it != geo_divs_id_to_index_.end() && colors_[it->second];
 }
 
 size_t InsetState::colors_size() const
 {
-  return colors_.size();
+  return static_cast<size_t>(std::count_if(
+    colors_.begin(),
+    colors_.end(),
+    [](const std::optional<Color> &c) {
+      return c.has_value();
+    }));
 }
 
 bool InsetState::converged() const
@@ -126,28 +139,82 @@ void InsetState::destroy_fftw_plans_for_flux()
 {
   grid_fluxx_init_.destroy_fftw_plan();
   grid_fluxy_init_.destroy_fftw_plan();
+  grid_fluxx_init_f_.destroy_fftw_plan();
+  grid_fluxy_init_f_.destroy_fftw_plan();
 }
 
 void InsetState::destroy_fftw_plans_for_rho()
 {
-  fftw_destroy_plan(fwd_plan_for_rho_);
-  fftw_destroy_plan(bwd_plan_for_rho_);
-}
-
-void InsetState::execute_fftw_bwd_plan() const
-{
-  fftw_execute(bwd_plan_for_rho_);
+  // The plans themselves stay in the pool for the next inset
+  fwd_plan_for_rho_ = nullptr;
+  bwd_plan_for_rho_ = nullptr;
+  fwd_plan_for_rho_f_ = nullptr;
+  bwd_plan_for_rho_f_ = nullptr;
+}
+
+void InsetState::execute_fftw_bwd_plan()
+{
+  timer.start("FFT: backward rho");
+  if (fp32_spectral_) {
+    fftwf_execute_r2r(
+      bwd_plan_for_rho_f_,
+      rho_ft_f_.as_1d_array(),
+      rho_init_f_.as_1d_array());
+    const float *src = rho_init_f_.as_1d_array();
+    double *dst = rho_init_.as_1d_array();
+    const size_t n = static_cast<size_t>(lx_) * ly_;
+#pragma omp parallel for schedule(static)
+    for (size_t k = 0; k < n; ++k) {
+      dst[k] = src[k];
+    }
+  } else {
+    fftw_execute_r2r(
+      bwd_plan_for_rho_,
+      rho_ft_.as_1d_array(),
+      rho_init_.as_1d_array());
+  }
+  timer.stop("FFT: backward rho");
 }
 
 void InsetState::execute_fftw_plans_for_flux()
 {
-  grid_fluxx_init_.execute_fftw_plan();
-  grid_fluxy_init_.execute_fftw_plan();
+  timer.start("FFT: flux x");
+  if (fp32_spectral_) {
+    grid_fluxx_init_f_.execute_fftw_plan();
+  } else {
+    grid_fluxx_init_.execute_fftw_plan();
+  }
+  timer.swap("FFT: flux x", "FFT: flux y");
+  if (fp32_spectral_) {
+    grid_fluxy_init_f_.execute_fftw_plan();
+  } else {
+    grid_fluxy_init_.execute_fftw_plan();
+  }
+  timer.stop("FFT: flux y");
 }
 
-void InsetState::execute_fftw_fwd_plan() const
+void InsetState::execute_fftw_fwd_plan()
 {
-  fftw_execute(fwd_plan_for_rho_);
+  timer.start("FFT: forward rho");
+  if (fp32_spectral_) {
+    const double *src = rho_init_.as_1d_array();
+    float *dst = rho_init_f_.as_1d_array();
+    const size_t n = static_cast<size_t>(lx_) * ly_;
+#pragma omp parallel for schedule(static)
+    for (size_t k = 0; k < n; ++k) {
+      dst[k] = static_cast<float>(src[k]);
+    }
+    fftwf_execute_r2r(
+      fwd_plan_for_rho_f_,
+      rho_init_f_.as_1d_array(),
+      rho_ft_f_.as_1d_array());
+  } else {
+    fftw_execute_r2r(
+      fwd_plan_for_rho_,
+      rho_init_.as_1d_array(),
+      rho_ft_.as_1d_array());
+  }
+  timer.stop("FFT: forward rho");
 }
 
 void InsetState::export_time_report() const
@@ -168,6 +235,12 @@ void InsetState::export_time_report() const
   csv_rows[0].push_back("Time (s)");
   csv_rows[0].push_back("Max Area Error");
 
+  // Bytes that the density fill holds, which it would allocate anew in
+  // every integration without a persistent workspace, and the bytes it
+  // actually allocated
+  csv_rows[0].push_back("Raster Bytes Held");
+  csv_rows[0].push_back("Raster Bytes Allocated");
+
   for (size_t i = 0; i < n_finished_integrations_; i++) {
 
     // Integration number
@@ -183,6 +256,11 @@ void InsetState::export_time_report() const
     std::ostringstream oss;
     oss << std::setprecision(16) << max_area_errors_[i];
     csv_rows[i + 1].push_back(oss.str());
+
+    const RasterBytes bytes =
+      (i < raster_bytes_.size()) ? raster_bytes_[i] : RasterBytes();
+    csv_rows[i + 1].push_back(std::to_string(bytes.held));
+    csv_rows[i + 1].push_back(std::to_string(bytes.allocated));
   }
 
   // Write to CSV object, and close file afterwards
@@ -201,20 +279,17 @@ const std::vector<GeoDiv> &InsetState::geo_divs() const
 // Const and non-const version of geo_div_at_id
 const GeoDiv &InsetState::geo_div_at_id(std::string id) const
 {
-  try {
-    return geo_divs_[geo_divs_id_to_index_.at(id)];
-  } catch (const std::out_of_range &e) {
-    std::cerr << "ERROR: Key '" << id
-              << "' not found in geo_divs_id_to_index_. "
-              << "Exception: " << e.what() << std::endl;
-    // Re-throw, or return a default value
-    throw;
-  }
+  return geo_divs_[geo_div_index(id)];
 }
 GeoDiv &InsetState::geo_div_at_id(std::string id)
+{
+  return geo_divs_[geo_div_index(id)];
+}
+
+uint32_t InsetState::geo_div_index(const std::string &id) const
 {
   try {
-    return geo_divs_[geo_divs_id_to_index_.at(id)];
+    return geo_divs_id_to_index_.at(id);
   } catch (const std::out_of_range &e) {
     std::cerr << "ERROR: Key '" << id
               << "' not found in geo_divs_id_to_index_. "
@@ -234,29 +309,30 @@ void InsetState::create_and_refine_quadtree()
   std::cerr << "Quadtree target leaf count (pre-grading): "
             << target_leaf_count << std::endl;
 
-  auto get_rho_diff = [&](uint32_t i, uint32_t j, uint32_t size) {
-    double rho_min = std::numeric_limits<double>::infinity();
-    double rho_max = -std::numeric_limits<double>::infinity();
-
-    const uint32_t x_end = std::min(i + size, lx_);
-    const uint32_t y_end = std::min(j + size, ly_);
-
-    for (uint32_t x = i; x < x_end; ++x) {
-      for (uint32_t y = j; y < y_end; ++y) {
-        const double rho = ref_to_rho_init()(x, y);
-        rho_min = std::min(rho_min, rho);
-        rho_max = std::max(rho_max, rho);
-      }
-    }
-    return (rho_max - rho_min);
-  };
-
-  Quadtree qt(std::max(lx_, ly_), target_leaf_count, get_rho_diff);
-  qt.build();
+  // Nodes with the largest density range are split first. The pyramid
+  // answers the range of any node in O(1).
+  rho_pyramid_.build(rho_init_.as_1d_array(), lx_, ly_);
+  if (args_.incremental_quadtree && update_quadtree()) {
+    timer.stop("Quadtree");
+    return;
+  }
+  Quadtree qt(
+    std::max(lx_, ly_),
+    target_leaf_count,
+    block_range_metric(rho_pyramid_));
+  if (args_.parallel_quadtree) {
+    qt.build_parallel();
+  } else {
+    qt.build();
+  }
 
   const size_t n_leaves_bef_grading = qt.num_leaves();
 
-  qt.grade();
+  if (args_.parallel_quadtree) {
+    qt.grade_parallel();
+  } else {
+    qt.grade();
+  }
 
   // Store the bounding boxes of the leaf nodes (updates
   // unique_quadtree_corners_)
@@ -275,9 +351,136 @@ void InsetState::create_and_refine_quadtree()
             << std::endl;
   std::cerr << "Quadtree nodes post-grading: " << qt.num_leaves() << std::endl;
 
+  // Keep the tree, the density it was built for, and how many leaves share
+  // each corner, so that the next integration can update them
+  if (args_.incremental_quadtree) {
+    auto &inc = incremental_qt_;
+    inc.lx = lx_;
+    inc.ly = ly_;
+    const double *rho = rho_init_.as_1d_array();
+    inc.rho.assign(rho, rho + size_t(lx_) * ly_);
+    inc.corner_leaves.assign(size_t(lx_ + 1) * (ly_ + 1), 0);
+    for (const auto &leaf : qt.leaves()) {
+      if (leaf.x + leaf.size <= lx_ && leaf.y + leaf.size <= ly_) {
+        for (const uint32_t cx : {leaf.x, leaf.x + leaf.size}) {
+          for (const uint32_t cy : {leaf.y, leaf.y + leaf.size}) {
+            ++inc.corner_leaves[size_t(cx) * (ly_ + 1) + cy];
+          }
+        }
+      }
+    }
+    inc.tree.emplace(std::move(qt));
+  }
+
   timer.stop("Quadtree");
 }
 
+bool InsetState::update_quadtree()
+{
+  auto &inc = incremental_qt_;
+  if (!inc.tree || inc.lx != lx_ || inc.ly != ly_) {
+    return false;
+  }
+
+  // A block needs to be revisited if the density in any of its cells has
+  // changed by more than the tolerance since the cell was last revisited
+  const double *rho = rho_init_.as_1d_array();
+  const size_t n_cells = size_t(lx_) * ly_;
+  inc.rho_change.resize(n_cells);
+#pragma omp parallel for schedule(static) default(none) \
+  shared(inc, rho, n_cells)
+  for (size_t i = 0; i < n_cells; ++i) {
+    inc.rho_change[i] = rho[i] - inc.rho[i];
+  }
+  inc.change_pyramid.build(inc.rho_change.data(), lx_, ly_);
+  const uint32_t root_size = inc.tree->root_size();
+  const double tolerance = incremental_quadtree_tolerance *
+                           rho_pyramid_.block_range(0, 0, root_size);
+  auto changed = [&](uint32_t x, uint32_t y, uint32_t size) {
+    if (x >= lx_ || y >= ly_) {
+      return false;
+    }
+    if (size == 1) {
+      return std::abs(inc.rho_change[size_t(x) * ly_ + y]) > tolerance;
+    }
+    const auto [lo, hi] = inc.change_pyramid.block_min_max(x, y, size);
+    return std::max(-lo, hi) > tolerance;
+  };
+
+  // The pyramid may have moved since the tree was built
+  inc.tree->set_metric(block_range_metric(rho_pyramid_));
+  const auto report = inc.tree->update(changed);
+  for (const auto &block : report.evaluated) {
+    for (uint32_t x = block.x; x < std::min(block.x + block.size, lx_); ++x) {
+      const size_t col = size_t(x) * ly_;
+      const uint32_t y_end = std::min(block.y + block.size, ly_);
+      for (uint32_t y = block.y; y < y_end; ++y) {
+        inc.rho[col + y] = rho[col + y];
+      }
+    }
+  }
+  std::cerr << "Quadtree update: " << report.evaluated.size()
+            << " blocks revisited, " << report.added.size()
+            << " leaves added, " << report.removed.size()
+            << " leaves removed" << std::endl;
+  if (report.added.empty() && report.removed.empty()) {
+    return true;
+  }
+
+  // Patch the corner list, where a corner is kept as long as a leaf inside
+  // the grid has it, and index it again
+  std::vector<QuadtreeCorner> touched;
+  auto count = [&](const auto &leaves, int delta) {
+    for (const auto &leaf : leaves) {
+      if (leaf.x + leaf.size > lx_ || leaf.y + leaf.size > ly_) {
+        continue;
+      }
+      for (const uint32_t cx : {leaf.x, leaf.x + leaf.size}) {
+        for (const uint32_t cy : {leaf.y, leaf.y + leaf.size}) {
+          auto &n = inc.corner_leaves[size_t(cx) * (ly_ + 1) + cy];
+          n = static_cast<uint8_t>(n + delta);
+          touched.emplace_back(cx, cy);
+        }
+      }
+    }
+  };
+  count(report.added, 1);
+  count(report.removed, -1);
+  auto used = [&](const QuadtreeCorner &c) {
+    return inc.corner_leaves[size_t(c.x()) * (ly_ + 1) + c.y()] > 0;
+  };
+  std::erase_if(unique_quadtree_corners_, [&](const QuadtreeCorner &c) {
+    return !used(c);
+  });
+  std::sort(touched.begin(), touched.end());
+  touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+  for (const QuadtreeCorner &c : touched) {
+    if (used(c) && !proj_data_.is_valid_corner(c.x(), c.y())) {
+      unique_quadtree_corners_.push_back(c);
+    }
+  }
+  proj_data_.build_fast_indexing(unique_quadtree_corners_);
+
+  quadtree_bboxes_.clear();
+  for (const auto &leaf : inc.tree->leaves()) {
+    if (leaf.x + leaf.size <= lx_ && leaf.y + leaf.size <= ly_) {
+      quadtree_bboxes_.emplace_back(
+        leaf.x,
+        leaf.y,
+        leaf.x + leaf.size,
+        leaf.y + leaf.size);
+    }
+  }
+  quadtree_bboxes_.emplace_back(0, 0, lx_, ly_);
+
+  qt_locator_.build(lx_, ly_, inc.tree->nodes());
+  std::cerr << "Number of unique quadtree corners: "
+            << unique_quadtree_corners_.size() << '\n'
+            << "Number of quadtree leaf nodes: " << inc.tree->num_leaves()
+            << std::endl;
+  return true;
+}
+
 template <class QuadtreeImp>
 void InsetState::store_quadtree_cell_corners(const QuadtreeImp &qt)
 {
@@ -368,40 +571,32 @@ void InsetState::initialize_identity_proj()
 
 void InsetState::insert_color(const std::string &id, const Color &c)
 {
-  if (colors_.count(id)) {
-    colors_.erase(id);
-  }
-  colors_.insert({id, c});
+  colors_[geo_div_index(id)] = c;
 }
 
 void InsetState::insert_color(const std::string &id, std::string &color)
 {
-  if (colors_.count(id)) {
-    colors_.erase(id);
-  }
-
   // From
   // https://stackoverflow.com/questions/313970/how-to-convert-stdstring-to-lower-case
   std::transform(color.begin(), color.end(), color.begin(), ::tolower);
-  const Color c(color);
-  colors_.insert({id, c});
+  colors_[geo_div_index(id)] = Color(color);
 }
 
 void InsetState::insert_label(const std::string &id, const std::string &label)
 {
-  labels_.insert({id, label});
+  labels_[geo_div_index(id)] = label;
 }
 
 void InsetState::insert_target_area(const std::string &id, const double area)
 {
-  target_areas_.insert({id, area});
+  target_areas_[geo_div_index(id)] = area;
 }
 
 void InsetState::insert_whether_input_target_area_is_missing(
   const std::string &id,
   const bool is_missing)
 {
-  is_input_target_area_missing_.insert({id, is_missing});
+  is_input_target_area_missing_[geo_div_index(id)] = is_missing;
 }
 
 std::string InsetState::inset_name() const
@@ -421,15 +616,7 @@ double InsetState::initial_target_area() const
 
 bool InsetState::is_input_target_area_missing(const std::string &id) const
 {
-  try {
-    return is_input_target_area_missing_.at(id);
-  } catch (const std::out_of_range &e) {
-    std::cerr << "ERROR: Key '" << id
-              << "' not found in is_input_target_area_missing_. "
-              << "Exception: " << e.what() << std::endl;
-    // Re-throw, or return a default value
-    throw;
-  }
+  return is_input_target_area_missing_[geo_div_index(id)];
 }
 
 double InsetState::latt_const() const
@@ -449,49 +636,46 @@ unsigned int InsetState::ly() const
 
 void InsetState::make_fftw_plans_for_rho()
 {
-  fwd_plan_for_rho_ = fftw_plan_r2r_2d(
-    static_cast<int>(lx_),  // fftw_plan_...() uses signed integers.
-    static_cast<int>(ly_),
-    rho_init_.as_1d_array(),
-    rho_ft_.as_1d_array(),
-    FFTW_REDFT10,
-    FFTW_REDFT10,
-    FFTW_ESTIMATE);
-  bwd_plan_for_rho_ = fftw_plan_r2r_2d(
-    static_cast<int>(lx_),
-    static_cast<int>(ly_),
-    rho_ft_.as_1d_array(),
-    rho_init_.as_1d_array(),
-    FFTW_REDFT01,
-    FFTW_REDFT01,
-    FFTW_ESTIMATE);
+  if (fp32_spectral_) {
+    fwd_plan_for_rho_f_ =
+      pooled_r2r_2d_planf(lx_, ly_, FFTW_REDFT10, FFTW_REDFT10, false);
+    bwd_plan_for_rho_f_ =
+      pooled_r2r_2d_planf(lx_, ly_, FFTW_REDFT01, FFTW_REDFT01, false);
+  } else {
+    fwd_plan_for_rho_ =
+      pooled_r2r_2d_plan(lx_, ly_, FFTW_REDFT10, FFTW_REDFT10, false);
+    bwd_plan_for_rho_ =
+      pooled_r2r_2d_plan(lx_, ly_, FFTW_REDFT01, FFTW_REDFT01, false);
+  }
 }
 
 void InsetState::make_fftw_plans_for_flux()
 {
-  grid_fluxx_init_.make_fftw_plan(FFTW_RODFT01, FFTW_REDFT01);
-  grid_fluxy_init_.make_fftw_plan(FFTW_REDFT01, FFTW_RODFT01);
+  if (fp32_spectral_) {
+    grid_fluxx_init_f_.make_fftw_plan(FFTW_RODFT01, FFTW_REDFT01);
+    grid_fluxy_init_f_.make_fftw_plan(FFTW_REDFT01, FFTW_RODFT01);
+  } else {
+    grid_fluxx_init_.make_fftw_plan(FFTW_RODFT01, FFTW_REDFT01);
+    grid_fluxy_init_.make_fftw_plan(FFTW_REDFT01, FFTW_RODFT01);
+  }
 }
 
 struct max_area_error_info InsetState::max_area_error() const
 {
-  auto it = area_errors_.begin();
   // Previously used to calculate average area error
   // TODO: max_area_error_info should return more information
   // including average and absolute area error
   // double sum_errors = 0.0;
   // size_t count = 0;
-  std::string worst_gd = it->first;
-  double value = it->second;
-  for (const auto &[gd_id, area_error] : area_errors_) {
-    if (area_error > value) {
-      value = area_error;
-      worst_gd = gd_id;
+  size_t worst_gd = 0;
+  for (size_t i = 1; i < area_errors_.size(); ++i) {
+    if (area_errors_[i] > area_errors_[worst_gd]) {
+      worst_gd = i;
     }
-    // sum_errors += area_error;
+    // sum_errors += area_errors_[i];
     // ++count;
   }
-  return {value, worst_gd};
+  return {area_errors_[worst_gd], geo_divs_[worst_gd].id()};
 }
 
 unsigned int InsetState::n_finished_integrations() const
@@ -532,10 +716,8 @@ void InsetState::normalize_target_area()
   double ta = total_target_area();
 
   // Assign normalized target area to GeoDivs
-  for (const auto &gd : geo_divs_) {
-    double normalized_target_area =
-      (target_area_at(gd.id()) / ta) * initial_area_;
-    replace_target_area(gd.id(), normalized_target_area);
+  for (double &target_area : target_areas_) {
+    target_area = (target_area / ta) * initial_area_;
   }
 }
 
@@ -556,8 +738,14 @@ void InsetState::print_time_report() const
 
 void InsetState::push_back(const GeoDiv &gd)
 {
-  geo_divs_id_to_index_.insert({gd.id(), geo_divs_.size()});
+  geo_divs_id_to_index_.insert(
+    {gd.id(), static_cast<uint32_t>(geo_divs_.size())});
   geo_divs_.push_back(gd);
+  area_errors_.push_back(0.0);
+  colors_.emplace_back();
+  is_input_target_area_missing_.push_back(false);
+  labels_.emplace_back();
+  target_areas_.push_back(std::numeric_limits<double>::quiet_NaN());
 }
 
 FTReal2d &InsetState::ref_to_fluxx_init()
@@ -606,7 +794,14 @@ void InsetState::remove_tiny_polygons(const double &minimum_polygon_size)
 
 void InsetState::replace_target_area(const std::string &id, const double area)
 {
-  target_areas_[id] = area;
+  target_areas_[geo_div_index(id)] = area;
+}
+
+void InsetState::replace_target_area(
+  const uint32_t gd_index,
+  const double area)
+{
+  target_areas_[gd_index] = area;
 }
 
 void InsetState::set_area_errors()
@@ -621,13 +816,12 @@ void InsetState::set_area_errors()
   // And our GeoDiv is 5% larger than it initially was, it has actually become
   // relatively smaller compared to the total cartogram area. Thus, we must
   // accordingly inflate its target area to account for the area drift.
-  double aef = area_expansion_factor();
+  const double aef = area_expansion_factor();
 
-#pragma omp parallel for default(none) firstprivate(aef) \
-  shared(geo_divs_, area_errors_)
-  for (const auto &gd : geo_divs_) {
-    const double obj_area = target_area_at(gd.id()) * aef;
-    area_errors_[gd.id()] = std::abs((gd.area() / obj_area) - 1);
+#pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < geo_divs_.size(); ++i) {
+    const double obj_area = target_areas_[i] * aef;
+    area_errors_[i] = std::abs((geo_divs_[i].area() / obj_area) - 1);
   }
 }
 
@@ -662,23 +856,14 @@ void InsetState::adjust_grid()
     transform_points(scale, true);
 
     normalize_target_area();
-    destroy_fftw_plans_for_rho();
-    destroy_fftw_plans_for_flux();
-    ref_to_rho_init().free();
-    ref_to_rho_ft().free();
-    ref_to_fluxx_init().free();
-    ref_to_fluxy_init().free();
-
-    // Reallocate FFTW plans
-    ref_to_rho_init().allocate(lx_, ly_);
-    ref_to_rho_ft().allocate(lx_, ly_);
-    ref_to_fluxx_init().allocate(lx_, ly_);
-    ref_to_fluxy_init().allocate(lx_, ly_);
-    make_fftw_plans_for_rho();
-    make_fftw_plans_for_flux();
+
+    // Reallocate FFTW grids and plans
+    free_ft_grids();
+    allocate_ft_grids();
     initialize_identity_proj();
     initialize_cum_proj();
     set_area_errors();
+    fp32_stall_.grid_changed();
 
     Bbox bb = bbox();
     std::cerr << "New grid dimensions: " << lx_ << " " << ly_
@@ -687,6 +872,37 @@ void InsetState::adjust_grid()
   }
 }
 
+void InsetState::allocate_ft_grids()
+{
+  rho_init_.allocate(lx_, ly_);
+  if (fp32_spectral_) {
+    rho_ft_f_.allocate(lx_, ly_);
+    grid_fluxx_init_f_.allocate(lx_, ly_);
+    grid_fluxy_init_f_.allocate(lx_, ly_);
+    rho_init_f_.allocate(lx_, ly_);
+  } else {
+    rho_ft_.allocate(lx_, ly_);
+    grid_fluxx_init_.allocate(lx_, ly_);
+    grid_fluxy_init_.allocate(lx_, ly_);
+  }
+  make_fftw_plans_for_rho();
+  make_fftw_plans_for_flux();
+}
+
+void InsetState::free_ft_grids()
+{
+  destroy_fftw_plans_for_rho();
+  destroy_fftw_plans_for_flux();
+  rho_init_.free();
+  rho_ft_.free();
+  grid_fluxx_init_.free();
+  grid_fluxy_init_.free();
+  rho_ft_f_.free();
+  grid_fluxx_init_f_.free();
+  grid_fluxy_init_f_.free();
+  rho_init_f_.free();
+}
+
 void InsetState::set_grid_dimensions(
   const unsigned int lx,
   const unsigned int ly)
@@ -713,36 +929,38 @@ void InsetState::store_initial_target_area(const double override)
 }
 
 bool InsetState::target_area_is_missing(const std::string &id) const
+{
+  return target_area_is_missing(geo_div_index(id));
+}
+
+bool InsetState::target_area_is_missing(const uint32_t gd_index) const
 {
   // We use negative area as indication that GeoDiv has no target area
-  try {
-    return target_areas_.at(id) < 0.0;
-  } catch (const std::out_of_range &e) {
-    std::cerr << "ERROR: Key '" << id << "' not found in target_areas_. "
-              << "Exception: " << e.what() << std::endl;
-    // Re-throw, or return a default value
-    throw;
-  }
+  return target_areas_[gd_index] < 0.0;
 }
 
 double InsetState::target_area_at(const std::string &id) const
 {
-  try {
-    return target_areas_.at(id);
-  } catch (const std::out_of_range &e) {
-    std::cerr << "ERROR: Key '" << id << "' not found in target_areas_. "
-              << "Exception: " << e.what() << std::endl;
-    // Re-throw, or return a default value
-    throw;
-  }
+  return target_areas_[geo_div_index(id)];
+}
+
+double InsetState::target_area_at(const uint32_t gd_index) const
+{
+  return target_areas_[gd_index];
 }
 
 double InsetState::total_inset_area(bool original_area) const
 {
   auto &geo_divs = original_area ? geo_divs_original_transformed_ : geo_divs_;
   double total_inset_area = 0.0;
-  for (const auto &gd : geo_divs) {
-    total_inset_area += gd.area();
+
+  // The rounding errors of a parallel sum depend on how the GeoDivs are split
+  // between threads. Hence, we sum serially if deterministic output is
+  // requested.
+#pragma omp parallel for if (!args_.deterministic) \
+  reduction(+ : total_inset_area)
+  for (size_t i = 0; i < geo_divs.size(); ++i) {
+    total_inset_area += geo_divs[i].area();
   }
   return total_inset_area;
 }
@@ -750,18 +968,26 @@ double InsetState::total_inset_area(bool original_area) const
 double InsetState::total_target_area() const
 {
   double inset_total_target_area = 0;
-  for (const auto &geo_div_target_area : target_areas_) {
-    inset_total_target_area += geo_div_target_area.second;
+  for (const double target_area : target_areas_) {
+    if (!std::isnan(target_area)) {
+      inset_total_target_area += target_area;
+    }
   }
   return inset_total_target_area;
 }
 
 std::string InsetState::label_at(const std::string &id) const
 {
-  if (labels_.find(id) == labels_.end()) {
+  const auto it = geo_divs_id_to_index_.find(id);
+  if (it == geo_divs_id_to_index_.end()) {
     return "";
   }
-  return labels_.at(id);
+  return labels_[it->second];
+}
+
+const std::string &InsetState::label_at(const uint32_t gd_index) const
+{
+  return labels_[gd_index];
 }
 
 void InsetState::store_original_geo_divs()
@@ -799,6 +1025,12 @@ void InsetState::update_gd_ids(
       throw;
     }
   }
+
+  // Re-intern the new IDs. The indices and attributes are unchanged.
+  geo_divs_id_to_index_.clear();
+  for (uint32_t i = 0; i < geo_divs_.size(); ++i) {
+    geo_divs_id_to_index_.insert({geo_divs_[i].id(), i});
+  }
 }
 
 void InsetState::move_points(double dx, double dy, bool project_original)
@@ -44,12 +44,8 @@ void InsetState::prepare_for_integration()
   // Prepare Inset for cartogram generation
 
   // Set up Fourier transforms
-  ref_to_rho_init().allocate(lx_, ly_);
-  ref_to_rho_ft().allocate(lx_, ly_);
-  ref_to_fluxx_init().allocate(lx_, ly_);
-  ref_to_fluxy_init().allocate(lx_, ly_);
-  make_fftw_plans_for_rho();
-  make_fftw_plans_for_flux();
+  fp32_spectral_ = args_.fp32_spectral;
+  allocate_ft_grids();
   if (args_.redirect_exports_to_stdout) {
     initialize_identity_proj();
     initialize_cum_proj();
@@ -65,17 +61,19 @@ void InsetState::prepare_for_integration()
   normalize_target_area();
 
   set_area_errors();
+  fp32_stall_.reset(max_area_error().value);
 }
 
 void InsetState::cleanup_after_integration()
 {
   // Destory FFTW plans and free memory for rho and flux initializations
-  destroy_fftw_plans_for_rho();
-  destroy_fftw_plans_for_flux();
-  ref_to_rho_init().free();
-  ref_to_rho_ft().free();
-  ref_to_fluxx_init().free();
-  ref_to_fluxy_init().free();
+  free_ft_grids();
+
+  // Release the scratch buffers of the integrator and the density fill, and
+  // the quadtree state kept between integrations for --incremental_quadtree
+  integration_ws_ = IntegrationWorkspace();
+  raster_ws_ = RasterWorkspace();
+  incremental_qt_ = IncrementalQuadtree();
 }
 
 bool InsetState::continue_integrating() const
@@ -145,6 +143,17 @@ bool InsetState::continue_integrating() const
   return continue_integration;
 }
 
+void InsetState::fall_back_to_fp64_if_stalled()
+{
+  if (fp32_stall_.stalled_after(max_area_error().value) && fp32_spectral_) {
+    std::cerr << "Area error is not decreasing in single precision. "
+              << "Switching to double precision." << std::endl;
+    free_ft_grids();
+    fp32_spectral_ = false;
+    allocate_ft_grids();
+  }
+}
+
 void InsetState::integrate(ProgressTracker &progress_tracker)
 {
   std::cerr << std::endl << "Integrating inset " << pos_ << std::endl;
@@ -206,6 +215,7 @@ void InsetState::integrate(ProgressTracker &progress_tracker)
 
     // 4. Update area errors and try again if necessary
     set_area_errors();
+    fall_back_to_fp64_if_stalled();
     adjust_grid();
     progress_tracker.print_progress_mid_integration(
       max_area_error().value,
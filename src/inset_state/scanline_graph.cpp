@@ -17,10 +17,11 @@ std::vector<std::vector<intersection> > InsetState::intersec_with_parallel_to(
   std::vector<std::vector<intersection> > scanlines(n_rays);
 
   // Iterate over GeoDivs in inset_state
-  for (const auto &gd : geo_divs_) {
+  for (uint32_t gd_index = 0; gd_index < geo_divs_.size(); ++gd_index) {
+    const GeoDiv &gd = geo_divs_[gd_index];
 
     // Find target density
-    const double target_density = target_area_at(gd.id()) / gd.area();
+    const double target_density = target_area_at(gd_index) / gd.area();
 
     // Iterate over "polygons with holes" in inset_state
     for (size_t i = 0; const auto &pwh : gd.polygons_with_holes()) {
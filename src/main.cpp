@@ -1,12 +1,24 @@
 #include "cartogram_info.hpp"
+#include "fftw_planner.hpp"
 #include "parse_arguments.hpp"
 #include "progress_tracker.hpp"
+#include "threading.hpp"
 
 int main(const int argc, const char *argv[])
 {
   // Parse command-line arguments
   Arguments args = parse_arguments(argc, argv);
 
+  // Limit the number of threads used by parallel computations
+  set_n_threads(args.n_threads);
+
+  // FFTW chooses different algorithms for different numbers of threads, so
+  // its results are only reproducible with a fixed number of threads
+  set_fftw_n_threads(args.deterministic ? 1 : n_threads());
+  if (!args.fftw_wisdom_file.empty()) {
+    use_fftw_wisdom_file(args.fftw_wisdom_file, args.fftw_patient);
+  }
+
   // Initialize cart_info. It contains all the information about the cartogram
   // that needs to be handled by functions called from main().
   CartogramInfo cart_info(args);
@@ -0,0 +1,247 @@
+#include "coverage_raster.hpp"
+#include <algorithm>
+#include <cmath>
+
+// ---------------------------------------------------------------------
+// Clipping Functions
+// ---------------------------------------------------------------------
+
+// Polygon clipping using the Sutherland–Hodgman algorithm
+template <typename IsInsideFn, typename ComputeIntersectionFn>
+static Polygon clip_polygon_sutherland_hodgman(
+  const Polygon &polygon,
+  IsInsideFn &&is_inside,
+  ComputeIntersectionFn &&compute_intersection)
+{
+  if (polygon.is_empty())
+    return polygon;
+
+  Polygon clipped;
+
+  Point prev_point = polygon[polygon.size() - 1];
+  bool prev_inside = is_inside(prev_point);
+
+  for (unsigned int i = 0; i < polygon.size(); ++i) {
+    Point curr_point = polygon[i];
+    bool curr_inside = is_inside(curr_point);
+
+    if (curr_inside) {
+      if (!prev_inside)
+        clipped.push_back(compute_intersection(prev_point, curr_point));
+      clipped.push_back(curr_point);
+    } else if (prev_inside) {
+      clipped.push_back(compute_intersection(prev_point, curr_point));
+    }
+
+    prev_point = curr_point;
+    prev_inside = curr_inside;
+  }
+  return clipped;
+}
+
+static Polygon clip_polygon_by_vertical_line(
+  const Polygon &polygon,
+  const double x,
+  const bool left_side)
+{
+  auto is_inside = [x, left_side](const Point &p) -> bool {
+    return left_side ? (p.x() >= x) : (p.x() <= x);
+  };
+  auto compute_intersection = [x](const Point &p, const Point &q) -> Point {
+    double y = p.y() + (q.y() - p.y()) * (x - p.x()) / (q.x() - p.x());
+    return Point(x, y);
+  };
+  return clip_polygon_sutherland_hodgman(
+    polygon,
+    is_inside,
+    compute_intersection);
+}
+
+static Polygon clip_polygon_by_horizontal_line(
+  const Polygon &polygon,
+  double y,
+  bool bottom_side)
+{
+  auto is_inside = [y, bottom_side](const Point &p) -> bool {
+    return bottom_side ? (p.y() >= y) : (p.y() <= y);
+  };
+  auto compute_intersection = [y](const Point &p, const Point &q) -> Point {
+    double x = p.x() + (q.x() - p.x()) * (y - p.y()) / (q.y() - p.y());
+    return Point(x, y);
+  };
+  return clip_polygon_sutherland_hodgman(
+    polygon,
+    is_inside,
+    compute_intersection);
+}
+
+static Polygon clip_polygon_by_rectangle(
+  const Polygon &polygon,
+  const Bbox &rect_bbox)
+{
+  Polygon clipped = polygon;
+  clipped = clip_polygon_by_vertical_line(clipped, rect_bbox.xmin(), true);
+  clipped = clip_polygon_by_vertical_line(clipped, rect_bbox.xmax(), false);
+  clipped = clip_polygon_by_horizontal_line(clipped, rect_bbox.ymin(), true);
+  clipped = clip_polygon_by_horizontal_line(clipped, rect_bbox.ymax(), false);
+  return clipped;
+}
+
+static double compute_polygon_rectangle_overlap_area(
+  const Polygon &polygon,
+  const Bbox &rect_bbox)
+{
+  Polygon clipped = clip_polygon_by_rectangle(polygon, rect_bbox);
+  return std::abs(clipped.area());
+}
+
+double compute_pwh_rectangle_overlap_area(
+  const Polygon_with_holes &pwh,
+  const Bbox &rect_bbox)
+{
+  double area = 0.0;
+  area +=
+    compute_polygon_rectangle_overlap_area(pwh.outer_boundary(), rect_bbox);
+  for (auto hole_it = pwh.holes_begin(); hole_it != pwh.holes_end();
+       ++hole_it) {
+    area -= compute_polygon_rectangle_overlap_area(*hole_it, rect_bbox);
+  }
+  return area;
+}
+
+// ---------------------------------------------------------------------
+// Coverage Accumulation
+// ---------------------------------------------------------------------
+
+// Part of a polygon ring inside cell (x, y). `area` is the signed area
+// between the ring and the top of the cell (y + 1), and `cover` is the signed
+// extent of the ring in x, which is added to all cells above (x, y).
+struct CoveragePiece {
+  unsigned int x;
+  unsigned int y;
+  double area;
+  double cover;
+};
+
+// Walks each edge of the ring across the grid in the style of a font
+// rasteriser. An edge is split at every grid line it crosses, in the order of
+// the Amanatides–Woo traversal, and each piece adds its signed area and
+// cover to its cell. Consecutive pieces in the same cell are merged.
+// Counter-clockwise rings (outer boundaries) add positive coverage and
+// clockwise rings (holes) negative coverage.
+static void add_ring_coverage(
+  const Polygon &ring,
+  const unsigned int lx,
+  const unsigned int ly,
+  std::vector<CoveragePiece> &pieces)
+{
+  const size_t n = ring.size();
+  if (n < 3) {
+    return;
+  }
+  auto add_piece = [&](const Point &a, const Point &b) {
+    const double mid_x = 0.5 * (a.x() + b.x());
+    const double mid_y = 0.5 * (a.y() + b.y());
+    const auto x = static_cast<unsigned int>(
+      std::clamp(std::floor(mid_x), 0.0, static_cast<double>(lx - 1)));
+    const auto y = static_cast<unsigned int>(
+      std::clamp(std::floor(mid_y), 0.0, static_cast<double>(ly - 1)));
+    const double dx = b.x() - a.x();
+    const double area = dx * (y + 1 - mid_y);
+    if (!pieces.empty() && pieces.back().x == x && pieces.back().y == y) {
+      pieces.back().area += area;
+      pieces.back().cover += dx;
+    } else {
+      pieces.push_back({x, y, area, dx});
+    }
+  };
+
+  for (size_t i = 0; i < n; ++i) {
+    const Point p = ring[i];
+    const Point q = ring[(i + 1) % n];
+    const double dx = q.x() - p.x();
+    const double dy = q.y() - p.y();
+
+    // Grid lines strictly between the endpoints, in the order in which the
+    // edge crosses them. For an axis-parallel edge, the range of crossings
+    // in the other direction is empty.
+    const int step_x = (dx > 0) ? 1 : -1;
+    const int step_y = (dy > 0) ? 1 : -1;
+    int next_x = static_cast<int>(
+      (dx > 0) ? std::floor(p.x()) + 1 : std::ceil(p.x()) - 1);
+    int next_y = static_cast<int>(
+      (dy > 0) ? std::floor(p.y()) + 1 : std::ceil(p.y()) - 1);
+    const int end_x = static_cast<int>(
+      (dx > 0) ? std::ceil(q.x()) : std::floor(q.x()));
+    const int end_y = static_cast<int>(
+      (dy > 0) ? std::ceil(q.y()) : std::floor(q.y()));
+    auto t_at_x = [&](int x) {
+      return (step_x * (end_x - x) > 0) ? (x - p.x()) / dx : 1.0;
+    };
+    auto t_at_y = [&](int y) {
+      return (step_y * (end_y - y) > 0) ? (y - p.y()) / dy : 1.0;
+    };
+    double t_x = t_at_x(next_x);
+    double t_y = t_at_y(next_y);
+
+    Point prev = p;
+    while (t_x < 1.0 || t_y < 1.0) {
+      const double t = std::min(t_x, t_y);
+      const Point curr(p.x() + t * dx, p.y() + t * dy);
+      if (t_x <= t) {
+        next_x += step_x;
+        t_x = t_at_x(next_x);
+      }
+      if (t_y <= t) {
+        next_y += step_y;
+        t_y = t_at_y(next_y);
+      }
+      add_piece(prev, curr);
+      prev = curr;
+    }
+    add_piece(prev, q);
+  }
+}
+
+void rasterize_pwh_coverage(
+  const Polygon_with_holes &pwh,
+  const unsigned int gd_id,
+  const unsigned int lx,
+  const unsigned int ly,
+  std::vector<CoverageSpan> &spans)
+{
+  std::vector<CoveragePiece> pieces;
+  add_ring_coverage(pwh.outer_boundary(), lx, ly, pieces);
+  for (const auto &hole : pwh.holes()) {
+    add_ring_coverage(hole, lx, ly, pieces);
+  }
+  std::sort(
+    pieces.begin(),
+    pieces.end(),
+    [](const CoveragePiece &a, const CoveragePiece &b) {
+      return (a.x != b.x) ? a.x < b.x : a.y < b.y;
+    });
+
+  size_t i = 0;
+  while (i < pieces.size()) {
+    const unsigned int x = pieces[i].x;
+    double cover = 0.0;
+    while (i < pieces.size() && pieces[i].x == x) {
+      const unsigned int y = pieces[i].y;
+      double area = 0.0;
+      double cell_cover = 0.0;
+      for (; i < pieces.size() && pieces[i].x == x && pieces[i].y == y; ++i) {
+        area += pieces[i].area;
+        cell_cover += pieces[i].cover;
+      }
+      const double coverage = std::clamp(cover + area, 0.0, 1.0);
+      spans.push_back({x, y, y + 1, gd_id, coverage});
+      cover += cell_cover;
+      const unsigned int next_y =
+        (i < pieces.size() && pieces[i].x == x) ? pieces[i].y : ly;
+      if (next_y > y + 1 && std::round(cover) >= 1.0) {
+        spans.push_back({x, y + 1, next_y, gd_id, 1.0});
+      }
+    }
+  }
+}
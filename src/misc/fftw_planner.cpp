@@ -0,0 +1,280 @@
+#include "fftw_planner.hpp"
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// The double- and single-precision FFTW libraries have the same interface
+// with different prefixes. FFTW<T> selects the functions for arrays of T.
+template <typename T> struct FFTW;
+
+template <> struct FFTW<double> {
+  using plan = fftw_plan;
+  static constexpr auto malloc = fftw_malloc;
+  static constexpr auto free = fftw_free;
+  static constexpr auto plan_r2r_2d = fftw_plan_r2r_2d;
+  static constexpr auto export_wisdom_to_string = fftw_export_wisdom_to_string;
+  static constexpr auto export_wisdom_to_filename =
+    fftw_export_wisdom_to_filename;
+  static constexpr auto import_wisdom_from_filename =
+    fftw_import_wisdom_from_filename;
+};
+
+template <> struct FFTW<float> {
+  using plan = fftwf_plan;
+  static constexpr auto malloc = fftwf_malloc;
+  static constexpr auto free = fftwf_free;
+  static constexpr auto plan_r2r_2d = fftwf_plan_r2r_2d;
+  static constexpr auto export_wisdom_to_string =
+    fftwf_export_wisdom_to_string;
+  static constexpr auto export_wisdom_to_filename =
+    fftwf_export_wisdom_to_filename;
+  static constexpr auto import_wisdom_from_filename =
+    fftwf_import_wisdom_from_filename;
+};
+
+static unsigned int planner_flags = FFTW_ESTIMATE;
+
+// FFTW keeps separate wisdom for each precision. Single-precision wisdom is
+// stored next to the double-precision wisdom file.
+static std::string wisdom_file;
+
+template <typename T> static std::string wisdom_file_for()
+{
+  return std::is_same_v<T, float> ? wisdom_file + ".fftwf" : wisdom_file;
+}
+
+// Pooled plans, keyed by (lx, ly, kind0, kind1, in_place), free buffers,
+// keyed by their number of elements, and the wisdom as last read from or
+// written to the wisdom file
+template <typename T> struct Pool {
+  std::map<
+    std::tuple<unsigned int, unsigned int, fftw_r2r_kind, fftw_r2r_kind, bool>,
+    typename FFTW<T>::plan>
+    plans;
+  std::unordered_map<size_t, std::vector<T *>> buffers;
+  std::string saved_wisdom;
+};
+
+static std::mutex pool_mutex;
+
+template <typename T> static Pool<T> &pool()
+{
+  static Pool<T> p;
+  return p;
+}
+
+void set_fftw_n_threads(const unsigned int n_threads)
+{
+#ifdef CARTOGRAM_FFTW_THREADS
+  static const bool fftw_threads_ok =
+    (fftw_init_threads() != 0 && fftwf_init_threads() != 0);
+  if (!fftw_threads_ok) {
+    std::cerr << "WARNING: Could not initialize FFTW threads. Running FFTW "
+                 "single-threaded."
+              << std::endl;
+    return;
+  }
+  fftw_plan_with_nthreads(static_cast<int>(n_threads));
+  fftwf_plan_with_nthreads(static_cast<int>(n_threads));
+#else
+  static_cast<void>(n_threads);
+#endif
+}
+
+template <typename T> static void import_wisdom()
+{
+  const std::string path = wisdom_file_for<T>();
+  if (std::filesystem::exists(path)) {
+    if (FFTW<T>::import_wisdom_from_filename(path.c_str()) == 0) {
+      std::cerr << "WARNING: Could not read FFTW wisdom from " << path
+                << ". It will be overwritten." << std::endl;
+    }
+  }
+  // The wisdom string is allocated with malloc(), not fftw_malloc()
+  char *wisdom = FFTW<T>::export_wisdom_to_string();
+  pool<T>().saved_wisdom = (wisdom != nullptr) ? wisdom : "";
+  std::free(wisdom);
+}
+
+void use_fftw_wisdom_file(const std::string &path, const bool patient)
+{
+  wisdom_file = path;
+  planner_flags = patient ? FFTW_PATIENT : FFTW_MEASURE;
+  import_wisdom<double>();
+  import_wisdom<float>();
+}
+
+// Write the current wisdom to the wisdom file if planning has added to it
+template <typename T> static void save_new_wisdom()
+{
+  char *wisdom = FFTW<T>::export_wisdom_to_string();
+  std::string &saved_wisdom = pool<T>().saved_wisdom;
+  if (wisdom == nullptr || saved_wisdom == wisdom) {
+    std::free(wisdom);
+    return;
+  }
+  saved_wisdom = wisdom;
+  std::free(wisdom);
+
+  // Write to a temporary file first so that other processes sharing the
+  // wisdom file never read a partially written one
+  const std::string path = wisdom_file_for<T>();
+  const std::string tmp_file =
+    path + "." + std::to_string(std::random_device{}()) + ".tmp";
+  std::error_code ec;
+  if (FFTW<T>::export_wisdom_to_filename(tmp_file.c_str()) != 0) {
+    std::filesystem::rename(tmp_file, path, ec);
+  }
+  if (ec || std::filesystem::exists(tmp_file)) {
+    std::filesystem::remove(tmp_file, ec);
+    std::cerr << "WARNING: Could not write FFTW wisdom to " << path
+              << std::endl;
+  }
+}
+
+template <typename T>
+static typename FFTW<T>::plan make_plan(
+  const unsigned int lx,
+  const unsigned int ly,
+  T *in,
+  T *out,
+  const fftw_r2r_kind kind0,
+  const fftw_r2r_kind kind1)
+{
+  const auto plan = FFTW<T>::plan_r2r_2d(
+    static_cast<int>(lx),  // fftw_plan_...() uses signed integers.
+    static_cast<int>(ly),
+    in,
+    out,
+    kind0,
+    kind1,
+    planner_flags);
+  if (!wisdom_file.empty()) {
+    save_new_wisdom<T>();
+  }
+  return plan;
+}
+
+fftw_plan make_r2r_2d_plan(
+  const unsigned int lx,
+  const unsigned int ly,
+  double *in,
+  double *out,
+  const fftw_r2r_kind kind0,
+  const fftw_r2r_kind kind1)
+{
+  return make_plan<double>(lx, ly, in, out, kind0, kind1);
+}
+
+fftwf_plan make_r2r_2d_plan(
+  const unsigned int lx,
+  const unsigned int ly,
+  float *in,
+  float *out,
+  const fftw_r2r_kind kind0,
+  const fftw_r2r_kind kind1)
+{
+  return make_plan<float>(lx, ly, in, out, kind0, kind1);
+}
+
+template <typename T> static T *acquire_buffer(const size_t n)
+{
+  {
+    const std::lock_guard<std::mutex> lock(pool_mutex);
+    auto &buffers = pool<T>().buffers;
+    auto it = buffers.find(n);
+    if (it != buffers.end() && !it->second.empty()) {
+      T *buffer = it->second.back();
+      it->second.pop_back();
+      return buffer;
+    }
+  }
+  return static_cast<T *>(FFTW<T>::malloc(n * sizeof(T)));
+}
+
+template <typename T> static void release_buffer(T *buffer, const size_t n)
+{
+  if (buffer == nullptr) {
+    return;
+  }
+  const std::lock_guard<std::mutex> lock(pool_mutex);
+  pool<T>().buffers[n].push_back(buffer);
+}
+
+double *acquire_fftw_buffer(const size_t n)
+{
+  return acquire_buffer<double>(n);
+}
+
+float *acquire_fftwf_buffer(const size_t n)
+{
+  return acquire_buffer<float>(n);
+}
+
+void release_fftw_buffer(double *buffer, const size_t n)
+{
+  release_buffer(buffer, n);
+}
+
+void release_fftw_buffer(float *buffer, const size_t n)
+{
+  release_buffer(buffer, n);
+}
+
+template <typename T>
+static typename FFTW<T>::plan pooled_plan(
+  const unsigned int lx,
+  const unsigned int ly,
+  const fftw_r2r_kind kind0,
+  const fftw_r2r_kind kind1,
+  const bool in_place)
+{
+  const std::lock_guard<std::mutex> lock(pool_mutex);
+  auto &plans = pool<T>().plans;
+  const auto key = std::make_tuple(lx, ly, kind0, kind1, in_place);
+  auto it = plans.find(key);
+  if (it != plans.end()) {
+    return it->second;
+  }
+
+  // Plan on scratch buffers, so that measuring plans cannot overwrite any
+  // data. fftw_malloc() gives every buffer the same alignment, so the plan
+  // can later be executed on any pooled buffer.
+  const size_t n = static_cast<size_t>(lx) * ly;
+  T *in = static_cast<T *>(FFTW<T>::malloc(n * sizeof(T)));
+  T *out = in_place ? in : static_cast<T *>(FFTW<T>::malloc(n * sizeof(T)));
+  const auto plan = make_plan<T>(lx, ly, in, out, kind0, kind1);
+  if (!in_place) {
+    FFTW<T>::free(out);
+  }
+  FFTW<T>::free(in);
+  plans.emplace(key, plan);
+  return plan;
+}
+
+fftw_plan pooled_r2r_2d_plan(
+  const unsigned int lx,
+  const unsigned int ly,
+  const fftw_r2r_kind kind0,
+  const fftw_r2r_kind kind1,
+  const bool in_place)
+{
+  return pooled_plan<double>(lx, ly, kind0, kind1, in_place);
+}
+
+fftwf_plan pooled_r2r_2d_planf(
+  const unsigned int lx,
+  const unsigned int ly,
+  const fftw_r2r_kind kind0,
+  const fftw_r2r_kind kind1,
+  const bool in_place)
+{
+  return pooled_plan<float>(lx, ly, kind0, kind1, in_place);
+}
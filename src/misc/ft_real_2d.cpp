@@ -1,18 +1,24 @@
 #include "ft_real_2d.hpp"
+#include "fftw_planner.hpp"
 #include <iostream>
+#include <type_traits>
 
-double *FTReal2d::as_1d_array() const
+template <typename T> T *BasicFTReal2d<T>::as_1d_array() const
 {
   return array_;
 }
 
-void FTReal2d::set_array_size(const unsigned int i, const unsigned int j)
+template <typename T>
+void BasicFTReal2d<T>::set_array_size(
+  const unsigned int i,
+  const unsigned int j)
 {
   lx_ = i;
   ly_ = j;
 }
 
-void FTReal2d::allocate(const unsigned int lx, const unsigned int ly)
+template <typename T>
+void BasicFTReal2d<T>::allocate(const unsigned int lx, const unsigned int ly)
 {
   if (lx * ly <= 0) {
     std::cerr
@@ -22,44 +28,59 @@ void FTReal2d::allocate(const unsigned int lx, const unsigned int ly)
   }
   lx_ = lx;
   ly_ = ly;
-  array_ = static_cast<double *>(fftw_malloc(lx_ * ly_ * sizeof(double)));
+  const size_t n = static_cast<size_t>(lx_) * ly_;
+  if constexpr (std::is_same_v<T, float>) {
+    array_ = acquire_fftwf_buffer(n);
+  } else {
+    array_ = acquire_fftw_buffer(n);
+  }
 }
 
-void FTReal2d::free()
+template <typename T> void BasicFTReal2d<T>::free()
 {
-  fftw_free(array_);
+  release_fftw_buffer(array_, static_cast<size_t>(lx_) * ly_);
+  array_ = nullptr;
 }
 
-void FTReal2d::make_fftw_plan(
+template <typename T>
+void BasicFTReal2d<T>::make_fftw_plan(
   const fftw_r2r_kind &kind0,
   const fftw_r2r_kind &kind1)
 {
-  plan_ = fftw_plan_r2r_2d(
-    static_cast<int>(lx_),
-    static_cast<int>(ly_),
-    array_,
-    array_,
-    kind0,
-    kind1,
-    FFTW_ESTIMATE);
+  if constexpr (std::is_same_v<T, float>) {
+    plan_ = pooled_r2r_2d_planf(lx_, ly_, kind0, kind1, true);
+  } else {
+    plan_ = pooled_r2r_2d_plan(lx_, ly_, kind0, kind1, true);
+  }
 }
 
-void FTReal2d::execute_fftw_plan()
+template <typename T> void BasicFTReal2d<T>::execute_fftw_plan()
 {
-  fftw_execute(plan_);
+  if constexpr (std::is_same_v<T, float>) {
+    fftwf_execute_r2r(plan_, array_, array_);
+  } else {
+    fftw_execute_r2r(plan_, array_, array_);
+  }
 }
 
-void FTReal2d::destroy_fftw_plan()
+template <typename T> void BasicFTReal2d<T>::destroy_fftw_plan()
 {
-  fftw_destroy_plan(plan_);
+  // The plan itself stays in the pool for the next array of the same size
+  plan_ = nullptr;
 }
 
-double &FTReal2d::operator()(const unsigned int i, const unsigned int j)
+template <typename T>
+T &BasicFTReal2d<T>::operator()(const unsigned int i, const unsigned int j)
 {
   return array_[i * ly_ + j];
 }
 
-double FTReal2d::operator()(const unsigned int i, const unsigned int j) const
+template <typename T>
+T BasicFTReal2d<T>::operator()(const unsigned int i, const unsigned int j)
+  const
 {
   return array_[i * ly_ + j];
 }
+
+template class BasicFTReal2d<double>;
+template class BasicFTReal2d<float>;
@@ -0,0 +1,62 @@
+#include "min_max_pyramid.hpp"
+#include <algorithm>
+
+void MinMaxPyramid::build(
+  const double *grid,
+  const uint32_t lx,
+  const uint32_t ly)
+{
+  lx_ = lx;
+  ly_ = ly;
+
+  // Levels up to the smallest block that covers the whole grid. The vectors
+  // keep their capacity, so rebuilding for the same grid does not allocate.
+  size_t n_levels = 0;
+  for (uint32_t nx = lx, ny = ly; nx > 1 || ny > 1; ++n_levels) {
+    nx = (nx + 1) / 2;
+    ny = (ny + 1) / 2;
+  }
+  levels_.resize(n_levels);
+  uint32_t nx = lx, ny = ly;
+  for (Level &level : levels_) {
+    nx = (nx + 1) / 2;
+    ny = (ny + 1) / 2;
+    level.nx = nx;
+    level.ny = ny;
+    level.cells.resize(static_cast<size_t>(nx) * ny);
+  }
+
+  // Each level is computed from the one below. The implicit barrier at the
+  // end of each `omp for` ensures that the level below is complete.
+#pragma omp parallel default(none) shared(grid, lx, ly)
+  for (size_t k = 0; k < levels_.size(); ++k) {
+    Level &level = levels_[k];
+    const Level *below = (k == 0) ? nullptr : &levels_[k - 1];
+    const uint32_t below_nx = (k == 0) ? lx : below->nx;
+    const uint32_t below_ny = (k == 0) ? ly : below->ny;
+
+#pragma omp for schedule(static)
+    for (uint32_t a = 0; a < level.nx; ++a) {
+      const uint32_t a_end = std::min(2 * a + 2, below_nx);
+      for (uint32_t b = 0; b < level.ny; ++b) {
+        const uint32_t b_end = std::min(2 * b + 2, below_ny);
+        MinMax m = {
+          std::numeric_limits<double>::infinity(),
+          -std::numeric_limits<double>::infinity()};
+        for (uint32_t i = 2 * a; i < a_end; ++i) {
+          for (uint32_t j = 2 * b; j < b_end; ++j) {
+            const size_t idx = static_cast<size_t>(i) * below_ny + j;
+            if (k == 0) {
+              m.min = std::min(m.min, grid[idx]);
+              m.max = std::max(m.max, grid[idx]);
+            } else {
+              m.min = std::min(m.min, below->cells[idx].min);
+              m.max = std::max(m.max, below->cells[idx].max);
+            }
+          }
+        }
+        level.cells[static_cast<size_t>(a) * level.ny + b] = m;
+      }
+    }
+  }
+}
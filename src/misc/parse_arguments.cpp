@@ -159,6 +159,47 @@ Arguments parse_arguments(const int argc, const char *argv[])
     .help("Unsigned int: Quadtree leaf count factor (should be a power of 2)")
     .default_value(default_quadtree_leaf_count_factor)
     .scan<'u', unsigned int>();
+  arguments.add_argument("--parallel_quadtree")
+    .help(
+      "Boolean: Refine the quadtree level by level on all threads instead of "
+      "one node at a time (same leaf count, slightly different leaves)")
+    .default_value(false)
+    .implicit_value(true);
+  arguments.add_argument("--incremental_quadtree")
+    .help(
+      "Boolean: Keep the quadtree between integrations and only refine or "
+      "coarsen it where the blurred density has changed")
+    .default_value(false)
+    .implicit_value(true);
+  arguments.add_argument("-j", "--threads")
+    .help(
+      "Integer: Number of threads for parallel computations [default: all "
+      "available]")
+    .default_value(static_cast<unsigned int>(0))
+    .scan<'u', unsigned int>();
+  arguments.add_argument("--deterministic")
+    .help(
+      "Boolean: Produce bit-identical results regardless of the number of "
+      "threads (slower)")
+    .default_value(false)
+    .implicit_value(true);
+  arguments.add_argument("--fftw_wisdom")
+    .help(
+      "File path: FFTW wisdom file. Fourier transforms are planned by "
+      "measurement, and new plans are saved to the file for later runs")
+    .default_value(std::string(""));
+  arguments.add_argument("--fftw_patient")
+    .help(
+      "Boolean: Plan Fourier transforms more thoroughly with --fftw_wisdom "
+      "(slow for grid sizes not yet in the wisdom file)")
+    .default_value(false)
+    .implicit_value(true);
+  arguments.add_argument("--fp32_spectral", "--fp32-spectral")
+    .help(
+      "Boolean: Compute Fourier transforms and fluxes in single precision "
+      "(faster, switches back to double precision if convergence stalls)")
+    .default_value(false)
+    .implicit_value(true);
 
   // Parse command-line arguments
   try {
@@ -180,6 +221,8 @@ Arguments parse_arguments(const int argc, const char *argv[])
     std::exit(15);
   }
   args.quadtree_leaf_count_factor = qlcf;
+  args.parallel_quadtree = arguments.get<bool>("--parallel_quadtree");
+  args.incremental_quadtree = arguments.get<bool>("--incremental_quadtree");
 
   // Set long grid-side length
   args.n_grid_rows_or_cols = arguments.get<unsigned int>("-n");
@@ -226,6 +269,18 @@ Arguments parse_arguments(const int argc, const char *argv[])
 
   args.timeout_in_seconds = arguments.get<unsigned int>("--timeout");
 
+  args.n_threads = arguments.get<unsigned int>("--threads");
+  args.deterministic = arguments.get<bool>("--deterministic");
+  args.fftw_wisdom_file = arguments.get<std::string>("--fftw_wisdom");
+  args.fftw_patient = arguments.get<bool>("--fftw_patient");
+  args.fp32_spectral = arguments.get<bool>("--fp32_spectral");
+  if (args.deterministic && !args.fftw_wisdom_file.empty()) {
+    std::cerr << "WARNING: --fftw_wisdom is ignored with --deterministic "
+              << "because measured FFTW plans may differ between runs."
+              << std::endl;
+    args.fftw_wisdom_file.clear();
+  }
+
   // arguments.present returns an optional
   args.id_col = arguments.present<std::string>("--id");
   args.area_col = arguments.present<std::string>("--area");
@@ -0,0 +1,115 @@
+#include "spectral_stage.hpp"
+#include "constants.hpp"
+#include <algorithm>
+#include <cmath>
+
+void SpectralStage::set_grid_size(const unsigned int lx, const unsigned int ly)
+{
+  if (lx == lx_ && ly == ly_) {
+    return;
+  }
+  lx_ = lx;
+  ly_ = ly;
+  const double inv_lx2 = 1.0 / (double(lx) * double(lx));
+  const double inv_ly2 = 1.0 / (double(ly) * double(ly));
+  u_.resize(lx);
+  u2_.resize(lx);
+  pi_u2_.resize(lx);
+  for (unsigned int i = 0; i < lx; ++i) {
+    u_[i] = double(i) / double(lx);
+    u2_[i] = (double(i) * double(i)) * inv_lx2;
+    pi_u2_[i] = pi * u2_[i];
+  }
+  v_.resize(ly);
+  v2_.resize(ly);
+  pi_v2_.resize(ly);
+  for (unsigned int j = 0; j < ly; ++j) {
+    v_[j] = double(j) / double(ly);
+    v2_[j] = (double(j) * double(j)) * inv_ly2;
+    pi_v2_[j] = pi * v2_[j];
+  }
+  w_x_.resize(lx);
+  w_y_.resize(ly);
+}
+
+template <typename T>
+void SpectralStage::blur_and_compute_flux(
+  BasicFTReal2d<T> &rho_ft,
+  BasicFTReal2d<T> &grid_fluxx_init,
+  BasicFTReal2d<T> &grid_fluxy_init,
+  const unsigned int lx,
+  const unsigned int ly,
+  const double blur_width)
+{
+  set_grid_size(lx, ly);
+
+  // The Fourier transform of a Gaussian is a Gaussian
+  const double prefactor =
+    (blur_width > 0.0) ? -0.5 * blur_width * blur_width * pi * pi : 0.0;
+  const double norm = 1.0 / (4.0 * double(lx) * double(ly));
+  for (unsigned int i = 0; i < lx; ++i) {
+    w_x_[i] = std::exp(prefactor * u2_[i]) * norm;
+  }
+  for (unsigned int j = 0; j < ly; ++j) {
+    w_y_[j] = std::exp(prefactor * v2_[j]);
+  }
+
+  T *const rho_ft_1d = rho_ft.as_1d_array();
+  T *const fluxx_1d = grid_fluxx_init.as_1d_array();
+  T *const fluxy_1d = grid_fluxy_init.as_1d_array();
+  const double *const w_y = w_y_.data();
+  const double *const v = v_.data();
+  const double *const pi_v2 = pi_v2_.data();
+
+  // Row i of rho_ft gives row i - 1 of grid_fluxx_init and row i of
+  // grid_fluxy_init, so that the rows can be processed independently
+#pragma omp parallel for schedule(static)
+  for (unsigned int i = 0; i < lx; ++i) {
+    T *const rho = rho_ft_1d + static_cast<size_t>(i) * ly;
+    T *const fy = fluxy_1d + static_cast<size_t>(i) * ly;
+    const double wi = w_x_[i];
+    const double u = u_[i];
+    const double pi_u2 = pi_u2_[i];
+
+    // Coefficients with v = 0 only contribute to the flux in x-direction,
+    // and coefficients with u = 0 only to the flux in y-direction
+    rho[0] = static_cast<T>(rho[0] * (wi * w_y[0]));
+    if (i == 0) {
+      for (unsigned int j = 1; j < ly; ++j) {
+        const T r = static_cast<T>(rho[j] * (wi * w_y[j]));
+        rho[j] = r;
+        fy[j - 1] = static_cast<T>(-r / v[j] / pi);
+      }
+    } else {
+      T *const fx = fluxx_1d + static_cast<size_t>(i - 1) * ly;
+      fx[0] = static_cast<T>(-rho[0] / u / pi);
+#pragma omp simd
+      for (unsigned int j = 1; j < ly; ++j) {
+        const T r = static_cast<T>(rho[j] * (wi * w_y[j]));
+        rho[j] = r;
+        const double neg_r_over_denom = -r / (pi_u2 + pi_v2[j]);
+        fx[j] = static_cast<T>(neg_r_over_denom * u);
+        fy[j - 1] = static_cast<T>(neg_r_over_denom * v[j]);
+      }
+    }
+    fy[ly - 1] = 0;
+  }
+
+  // There is no rho_ft(lx, j) for grid_fluxx_init(lx - 1, j)
+  std::fill_n(fluxx_1d + static_cast<size_t>(lx - 1) * ly, ly, T(0));
+}
+
+template void SpectralStage::blur_and_compute_flux(
+  FTReal2d &,
+  FTReal2d &,
+  FTReal2d &,
+  unsigned int,
+  unsigned int,
+  double);
+template void SpectralStage::blur_and_compute_flux(
+  FTReal2df &,
+  FTReal2df &,
+  FTReal2df &,
+  unsigned int,
+  unsigned int,
+  double);
@@ -0,0 +1,34 @@
+#include "threading.hpp"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+void set_n_threads(const unsigned int n_threads)
+{
+#ifdef _OPENMP
+  if (n_threads > 0) {
+    omp_set_num_threads(static_cast<int>(n_threads));
+  }
+#else
+  static_cast<void>(n_threads);
+#endif
+}
+
+unsigned int n_threads()
+{
+#ifdef _OPENMP
+  return static_cast<unsigned int>(omp_get_max_threads());
+#else
+  return 1;
+#endif
+}
+
+unsigned int thread_num()
+{
+#ifdef _OPENMP
+  return static_cast<unsigned int>(omp_get_thread_num());
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,52 @@
+#include "velocity_field.hpp"
+
+template <typename T>
+void VelocityField::build(
+  const BasicFTReal2d<T> &grid_fluxx_init,
+  const BasicFTReal2d<T> &grid_fluxy_init,
+  const FTReal2d &rho_init,
+  const BasicFTReal2d<T> &rho_ft,
+  const unsigned int lx,
+  const unsigned int ly)
+{
+  lx_ = lx;
+  ly_ = ly;
+  rho_mean_ = static_cast<double>(rho_ft(0, 0));
+  nodes_.resize(static_cast<size_t>(lx + 2) * (ly + 2));
+
+#pragma omp parallel for schedule(static)
+  for (unsigned int a = 0; a < lx + 2; ++a) {
+
+    // Grid cell whose values are copied to this node
+    const unsigned int i = (a == 0) ? 0 : std::min(a - 1, lx - 1);
+    const bool x_boundary = (a == 0 || a == lx + 1);
+    for (unsigned int b = 0; b < ly + 2; ++b) {
+      const unsigned int j = (b == 0) ? 0 : std::min(b - 1, ly - 1);
+      const bool y_boundary = (b == 0 || b == ly + 1);
+      Node &n = nodes_[static_cast<size_t>(a) * (ly + 2) + b];
+
+      // The flux through the boundary of the domain is zero
+      const double fluxx = grid_fluxx_init(i, j);
+      const double fluxy = grid_fluxy_init(i, j);
+      n.neg_flux_x = x_boundary ? 0.0 : -fluxx;
+      n.neg_flux_y = y_boundary ? 0.0 : -fluxy;
+      n.drho = rho_init(i, j) - rho_mean_;
+      n.padding = 0.0;
+    }
+  }
+}
+
+template void VelocityField::build(
+  const FTReal2d &,
+  const FTReal2d &,
+  const FTReal2d &,
+  const FTReal2d &,
+  unsigned int,
+  unsigned int);
+template void VelocityField::build(
+  const FTReal2df &,
+  const FTReal2df &,
+  const FTReal2d &,
+  const FTReal2df &,
+  unsigned int,
+  unsigned int);
@@ -0,0 +1,116 @@
+#define BOOST_TEST_MODULE test_coverage_raster
+#include "cgal_typedef.hpp"
+#include "coverage_raster.hpp"
+#include <boost/test/included/unit_test.hpp>
+#include <cmath>
+#include <initializer_list>
+#include <vector>
+
+namespace
+{
+constexpr unsigned int lx = 16, ly = 16;
+
+Polygon ring(std::initializer_list<Point> pts)
+{
+  Polygon p;
+  for (const auto &pt : pts) {
+    p.push_back(pt);
+  }
+  return p;
+}
+
+Polygon_with_holes pwh_with_holes(
+  const Polygon &outer,
+  const std::vector<Polygon> &holes)
+{
+  return Polygon_with_holes(outer, holes.begin(), holes.end());
+}
+
+// Checks the coverage of every cell against the area found by clipping pwh
+// to the cell. Cells must not be covered by more than one span.
+void check_coverage_matches_clipping(const Polygon_with_holes &pwh)
+{
+  std::vector<CoverageSpan> spans;
+  rasterize_pwh_coverage(pwh, 0, lx, ly, spans);
+
+  std::vector<double> coverage(lx * ly, 0.0);
+  std::vector<unsigned int> n_spans(lx * ly, 0);
+  size_t n_interior_cells = 0;
+  for (const auto &span : spans) {
+    BOOST_TEST_REQUIRE(span.x < lx);
+    BOOST_TEST_REQUIRE(span.y_begin < span.y_end);
+    BOOST_TEST_REQUIRE(span.y_end <= ly);
+    if (span.y_end - span.y_begin > 1) {
+      BOOST_TEST(span.coverage == 1.0);
+      n_interior_cells += span.y_end - span.y_begin;
+    }
+    for (unsigned int y = span.y_begin; y < span.y_end; ++y) {
+      coverage[span.x * ly + y] += span.coverage;
+      ++n_spans[span.x * ly + y];
+    }
+  }
+  BOOST_TEST(n_interior_cells > 0u);
+
+  for (unsigned int x = 0; x < lx; ++x) {
+    for (unsigned int y = 0; y < ly; ++y) {
+      BOOST_TEST_CONTEXT("cell (" << x << ", " << y << ")")
+      {
+        const double expected =
+          compute_pwh_rectangle_overlap_area(pwh, Bbox(x, y, x + 1, y + 1));
+        BOOST_TEST(n_spans[x * ly + y] <= 1u);
+        BOOST_TEST(std::abs(coverage[x * ly + y] - expected) < 1e-12);
+      }
+    }
+  }
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(polygon_with_fractional_vertices)
+{
+  check_coverage_matches_clipping(pwh_with_holes(
+    ring(
+      {Point(1.3, 0.7),
+       Point(13.6, 2.2),
+       Point(9.1, 7.45),
+       Point(14.8, 14.1),
+       Point(2.25, 12.9),
+       Point(5.5, 6.6)}),
+    {}));
+}
+
+BOOST_AUTO_TEST_CASE(polygon_with_holes)
+{
+  check_coverage_matches_clipping(pwh_with_holes(
+    ring(
+      {Point(0.5, 0.5),
+       Point(15.5, 0.5),
+       Point(15.5, 15.5),
+       Point(0.5, 15.5)}),
+    {ring(
+       {Point(2.3, 2.7),
+        Point(3.1, 7.9),
+        Point(6.6, 6.2),
+        Point(5.4, 3.3)}),
+     ring(
+       {Point(9.5, 9.5),
+        Point(9.5, 13.25),
+        Point(13.75, 13.25),
+        Point(13.75, 9.5)})}));
+}
+
+BOOST_AUTO_TEST_CASE(edges_on_grid_lines_and_vertices_on_grid_corners)
+{
+  // The outer boundary and the hole only have vertices on grid corners and
+  // axis-parallel edges on grid lines, so every cell is fully covered or not
+  // covered at all
+  check_coverage_matches_clipping(pwh_with_holes(
+    ring({Point(2, 3), Point(12, 3), Point(12, 14), Point(2, 14)}),
+    {ring({Point(5, 6), Point(5, 9), Point(8, 9), Point(8, 6)})}));
+}
+
+BOOST_AUTO_TEST_CASE(diagonal_edges_through_grid_corners)
+{
+  check_coverage_matches_clipping(pwh_with_holes(
+    ring({Point(8, 1), Point(15, 8), Point(8, 15), Point(1, 8)}),
+    {ring({Point(8, 5), Point(5, 8), Point(8, 11), Point(11, 8)})}));
+}
@@ -0,0 +1,155 @@
+#define BOOST_TEST_MODULE test_densify_ring
+#include "cgal_typedef.hpp"
+#include "densify_ring.hpp"
+#include <algorithm>
+#include <array>
+#include <boost/test/included/unit_test.hpp>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <vector>
+
+namespace
+{
+constexpr uint32_t lx = 8, ly = 8;
+
+struct Corner {
+  uint32_t x_, y_;
+  [[nodiscard]] uint32_t x() const
+  {
+    return x_;
+  }
+  [[nodiscard]] uint32_t y() const
+  {
+    return y_;
+  }
+};
+
+struct Triangle {
+  std::array<Corner, 3> vertices;
+};
+
+// Uniform quadtree of unit leaves, each split into two triangles by the
+// diagonal through its bottom-left corner
+class UniformLeaves
+{
+public:
+  struct Leaf {
+    uint32_t x, y, size;
+  };
+
+  UniformLeaves()
+  {
+    for (uint32_t x = 0; x < lx; ++x) {
+      for (uint32_t y = 0; y < ly; ++y) {
+        triangles_.push_back({{{{x, y}, {x + 1, y}, {x + 1, y + 1}}}});
+        triangles_.push_back({{{{x, y}, {x + 1, y + 1}, {x, y + 1}}}});
+      }
+    }
+  }
+
+  [[nodiscard]] Leaf locate(const double px, const double py) const
+  {
+    const auto x = static_cast<uint32_t>(std::clamp(px, 0.0, lx - 1.0));
+    const auto y = static_cast<uint32_t>(std::clamp(py, 0.0, ly - 1.0));
+    return {x, y, 1};
+  }
+
+  [[nodiscard]] std::span<const Triangle> leaf_triangles(
+    const uint32_t x,
+    const uint32_t y) const
+  {
+    return {triangles_.data() + 2 * (x * ly + y), 2};
+  }
+
+private:
+  std::vector<Triangle> triangles_;
+};
+
+Polygon ring(std::initializer_list<Point> pts)
+{
+  Polygon p;
+  for (const auto &pt : pts) {
+    p.push_back(pt);
+  }
+  return p;
+}
+
+Polygon densify(const Polygon &r)
+{
+  const UniformLeaves leaves;
+  std::vector<leaf_walk::Hit> hits;
+  Polygon r_dens;
+  leaf_walk::densify_ring(r, leaves, leaves, lx, ly, hits, r_dens);
+  return r_dens;
+}
+
+void check_no_consecutive_duplicates(const Polygon &r)
+{
+  for (size_t i = 0; i < r.size(); ++i) {
+    BOOST_TEST_CONTEXT("vertex " << i)
+    {
+      BOOST_TEST(r[i] != r[(i + 1) % r.size()]);
+    }
+  }
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(points_are_added_at_triangle_edges)
+{
+  const Polygon r_dens = densify(
+    ring({Point(0.5, 0.5), Point(3.5, 0.5), Point(3.5, 2.5)}));
+
+  // Besides its start, the bottom edge crosses three vertical grid lines and
+  // two diagonals, the right edge two horizontal grid lines and one
+  // diagonal, and the slanted edge three vertical and two horizontal grid
+  // lines. It runs from one diagonal to the next, so crosses none.
+  BOOST_TEST(r_dens.size() == (1u + 3u + 2u) + (1u + 2u + 1u) + (1u + 5u));
+  check_no_consecutive_duplicates(r_dens);
+}
+
+BOOST_AUTO_TEST_CASE(repeated_vertices_are_not_duplicated)
+{
+  const Polygon r = ring(
+    {Point(0.5, 0.5),
+     Point(3.5, 0.5),
+     Point(3.5, 0.5),
+     Point(3.5, 2.5),
+     Point(0.5, 2.5),
+     Point(0.5, 0.5)});
+  const Polygon r_dens = densify(r);
+  check_no_consecutive_duplicates(r_dens);
+
+  // Same ring without the repeated vertices
+  const Polygon r_simple = densify(ring(
+    {Point(0.5, 0.5), Point(3.5, 0.5), Point(3.5, 2.5), Point(0.5, 2.5)}));
+  BOOST_TEST(r_dens.size() == r_simple.size());
+}
+
+BOOST_AUTO_TEST_CASE(shared_boundary_gets_same_points_from_both_sides)
+{
+  // Both rings share the edge from (4.25, 1.5) to (2.75, 6.5), in opposite
+  // directions
+  const Polygon left = densify(
+    ring({Point(0.5, 1.5), Point(4.25, 1.5), Point(2.75, 6.5)}));
+  const Polygon right = densify(
+    ring({Point(4.25, 1.5), Point(7.5, 3.5), Point(2.75, 6.5)}));
+  auto on_shared_edge = [](const Polygon &r) {
+    std::vector<Point> pts;
+    for (const auto &p : r) {
+      // Points on the line through (4.25, 1.5) and (2.75, 6.5)
+      if (std::abs(10.0 * p.x() + 3.0 * p.y() - 47.0) < 1e-9) {
+        pts.push_back(p);
+      }
+    }
+    std::sort(pts.begin(), pts.end());
+    return pts;
+  };
+  const auto a = on_shared_edge(left);
+  const auto b = on_shared_edge(right);
+  BOOST_TEST_REQUIRE(a.size() == b.size());
+  BOOST_TEST(a.size() > 2u);
+  for (size_t i = 0; i < a.size(); ++i) {
+    BOOST_TEST(a[i] == b[i]);
+  }
+}
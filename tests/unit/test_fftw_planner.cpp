@@ -0,0 +1,64 @@
+#define BOOST_TEST_MODULE test_fftw_planner
+#include "fftw_planner.hpp"
+#include <boost/test/included/unit_test.hpp>
+#include <cmath>
+#include <cstddef>
+
+BOOST_AUTO_TEST_CASE(released_buffers_are_reused_for_the_same_size)
+{
+  double *a = acquire_fftw_buffer(64);
+  release_fftw_buffer(a, 64);
+  double *b = acquire_fftw_buffer(64);
+  BOOST_TEST(a == b);
+
+  // A buffer of a different size is not handed out
+  double *c = acquire_fftw_buffer(32);
+  BOOST_TEST(c != b);
+  release_fftw_buffer(b, 64);
+  release_fftw_buffer(c, 32);
+}
+
+BOOST_AUTO_TEST_CASE(plans_are_shared_by_key)
+{
+  const fftw_plan p1 =
+    pooled_r2r_2d_plan(8, 4, FFTW_REDFT10, FFTW_REDFT10, false);
+  const fftw_plan p2 =
+    pooled_r2r_2d_plan(8, 4, FFTW_REDFT10, FFTW_REDFT10, false);
+  const fftw_plan p3 =
+    pooled_r2r_2d_plan(8, 4, FFTW_REDFT10, FFTW_REDFT10, true);
+  const fftw_plan p4 =
+    pooled_r2r_2d_plan(4, 8, FFTW_REDFT10, FFTW_REDFT10, false);
+  BOOST_TEST(p1 == p2);
+  BOOST_TEST(p1 != p3);
+  BOOST_TEST(p1 != p4);
+}
+
+BOOST_AUTO_TEST_CASE(pooled_plans_run_on_pooled_buffers)
+{
+  constexpr unsigned int lx = 8, ly = 4;
+  constexpr size_t n = lx * ly;
+  const fftw_plan fwd =
+    pooled_r2r_2d_plan(lx, ly, FFTW_REDFT10, FFTW_REDFT10, false);
+  const fftw_plan bwd =
+    pooled_r2r_2d_plan(lx, ly, FFTW_REDFT01, FFTW_REDFT01, false);
+  double *in = acquire_fftw_buffer(n);
+  double *out = acquire_fftw_buffer(n);
+  for (size_t k = 0; k < n; ++k) {
+    in[k] = static_cast<double>(k % 5) - 1.5;
+  }
+  double *original = acquire_fftw_buffer(n);
+  for (size_t k = 0; k < n; ++k) {
+    original[k] = in[k];
+  }
+
+  // The unnormalised DCT-II followed by DCT-III multiplies by 4 * lx * ly
+  fftw_execute_r2r(fwd, in, out);
+  fftw_execute_r2r(bwd, out, in);
+  const double scale = 4.0 * static_cast<double>(n);
+  for (size_t k = 0; k < n; ++k) {
+    BOOST_TEST(std::abs(in[k] / scale - original[k]) <= 1e-12);
+  }
+  release_fftw_buffer(in, n);
+  release_fftw_buffer(out, n);
+  release_fftw_buffer(original, n);
+}
@@ -0,0 +1,87 @@
+#define BOOST_TEST_MODULE test_fp32_stall_detector
+#include "fp32_stall_detector.hpp"
+#include <boost/test/included/unit_test.hpp>
+
+namespace
+{
+// Area error after an integration that reduces it by only 1%
+double stalled(const double max_area_error)
+{
+  return 0.99 * max_area_error;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(decreasing_error_does_not_fall_back)
+{
+  Fp32StallDetector stall;
+  double err = 1.0;
+  stall.reset(err);
+  for (int i = 0; i < 20; ++i) {
+    err *= 0.5;
+    BOOST_TEST(!stall.stalled_after(err));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(single_stalls_do_not_fall_back)
+{
+  Fp32StallDetector stall;
+  double err = 1.0;
+  stall.reset(err);
+  for (int i = 0; i < 10; ++i) {
+    for (unsigned int k = 1; k < fp32_spectral_max_stalls; ++k) {
+      err = stalled(err);
+      BOOST_TEST(!stall.stalled_after(err));
+    }
+    err *= 0.5;
+    BOOST_TEST(!stall.stalled_after(err));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(consecutive_stalls_fall_back)
+{
+  Fp32StallDetector stall;
+  double err = 1.0;
+  stall.reset(err);
+  err *= 0.5;
+  BOOST_TEST(!stall.stalled_after(err));
+  for (unsigned int k = 1; k < fp32_spectral_max_stalls; ++k) {
+    err = stalled(err);
+    BOOST_TEST(!stall.stalled_after(err));
+  }
+  BOOST_TEST(stall.stalled_after(stalled(err)));
+}
+
+BOOST_AUTO_TEST_CASE(integration_after_grid_change_is_not_judged)
+{
+  Fp32StallDetector stall;
+  double err = 1.0;
+  stall.reset(err);
+  for (unsigned int k = 1; k < fp32_spectral_max_stalls; ++k) {
+    err = stalled(err);
+    BOOST_TEST(!stall.stalled_after(err));
+  }
+
+  // The error may even grow on the refined grid. Afterwards, the count of
+  // stalls starts from zero.
+  stall.grid_changed();
+  err *= 2.0;
+  BOOST_TEST(!stall.stalled_after(err));
+  for (unsigned int k = 1; k < fp32_spectral_max_stalls; ++k) {
+    err = stalled(err);
+    BOOST_TEST(!stall.stalled_after(err));
+  }
+  BOOST_TEST(stall.stalled_after(stalled(err)));
+}
+
+BOOST_AUTO_TEST_CASE(reset_forgets_earlier_stalls)
+{
+  Fp32StallDetector stall;
+  double err = 1.0;
+  stall.reset(err);
+  for (unsigned int k = 1; k < fp32_spectral_max_stalls; ++k) {
+    err = stalled(err);
+    BOOST_TEST(!stall.stalled_after(err));
+  }
+  stall.reset(err);
+  BOOST_TEST(!stall.stalled_after(stalled(err)));
+}
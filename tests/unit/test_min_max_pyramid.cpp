@@ -0,0 +1,90 @@
+#define BOOST_TEST_MODULE test_min_max_pyramid
+#include "min_max_pyramid.hpp"
+#include "quadtree.hpp"
+#include <algorithm>
+#include <bit>
+#include <boost/test/included/unit_test.hpp>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace
+{
+std::vector<double> random_grid(const uint32_t lx, const uint32_t ly)
+{
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<double> rho(0.0, 10.0);
+  std::vector<double> grid(static_cast<size_t>(lx) * ly);
+  for (double &g : grid) {
+    g = rho(rng);
+  }
+  return grid;
+}
+
+// Range of the grid over a block by scanning all its cells, as the quadtree
+// metric did before the pyramid
+double scan_range(
+  const std::vector<double> &grid,
+  uint32_t lx,
+  uint32_t ly,
+  uint32_t i,
+  uint32_t j,
+  uint32_t size)
+{
+  double rho_min = std::numeric_limits<double>::infinity();
+  double rho_max = -std::numeric_limits<double>::infinity();
+  for (uint32_t x = i; x < std::min(i + size, lx); ++x) {
+    for (uint32_t y = j; y < std::min(j + size, ly); ++y) {
+      rho_min = std::min(rho_min, grid[x * ly + y]);
+      rho_max = std::max(rho_max, grid[x * ly + y]);
+    }
+  }
+  return rho_max - rho_min;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(block_range_matches_scan_for_all_aligned_blocks)
+{
+  for (const auto &[lx, ly] : {std::pair{16u, 8u}, {4u, 32u}, {8u, 8u}}) {
+    const std::vector<double> grid = random_grid(lx, ly);
+    MinMaxPyramid pyramid;
+    pyramid.build(grid.data(), lx, ly);
+    const uint32_t root = std::max(lx, ly);
+    for (uint32_t size = 1; size <= root; size *= 2) {
+      for (uint32_t i = 0; i < root; i += size) {
+        for (uint32_t j = 0; j < root; j += size) {
+          const double expected = scan_range(grid, lx, ly, i, j, size);
+          const double range = pyramid.block_range(i, j, size);
+
+          // Bitwise comparison because the ranges must be exact
+          BOOST_TEST(
+            std::bit_cast<uint64_t>(range) ==
+            std::bit_cast<uint64_t>(expected));
+        }
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(quadtree_leaves_match_scanning_metric)
+{
+  constexpr uint32_t lx = 64, ly = 32;
+  const std::vector<double> grid = random_grid(lx, ly);
+  MinMaxPyramid pyramid;
+  pyramid.build(grid.data(), lx, ly);
+  auto scan = [&](uint32_t i, uint32_t j, uint32_t size) {
+    return scan_range(grid, lx, ly, i, j, size);
+  };
+  Quadtree qt_scan(lx, 100, scan);
+  Quadtree qt_pyramid(lx, 100, block_range_metric(pyramid));
+  qt_scan.build();
+  qt_pyramid.build();
+  const auto a = qt_scan.leaves();
+  const auto b = qt_pyramid.leaves();
+  BOOST_TEST_REQUIRE(a.size() == b.size());
+  for (size_t k = 0; k < a.size(); ++k) {
+    BOOST_TEST(a[k].x == b[k].x);
+    BOOST_TEST(a[k].y == b[k].y);
+    BOOST_TEST(a[k].size == b[k].size);
+  }
+}
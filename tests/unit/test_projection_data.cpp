@@ -329,3 +329,38 @@ BOOST_AUTO_TEST_CASE(capacity_growth_zero_initializes_new_regions)
   BOOST_TEST(!pd.is_valid_corner(0, 15));
   BOOST_TEST(!pd.is_valid_corner(31, 0));
 }
+
+BOOST_AUTO_TEST_CASE(every_point_indexed_across_block_boundaries)
+{
+  // Shape that is not a multiple of the 8 x 8 blocks of the bitmap, with
+  // every lattice point a corner, listed in reverse order
+  const uint32_t lx = 17, ly = 13;
+  ProjectionData pd;
+  pd.reserve(lx, ly);
+  std::vector<QuadtreeCorner> keys;
+  for (uint32_t x = lx; x-- > 0;) {
+    for (uint32_t y = ly; y-- > 0;) {
+      keys.emplace_back(x, y);
+    }
+  }
+  fill_projection(pd.get_projection(), keys.size());
+  pd.build_fast_indexing(keys);
+  for (uint32_t i = 0; i < keys.size(); ++i) {
+    BOOST_TEST(pd.is_valid_corner(keys[i].x(), keys[i].y()));
+    BOOST_TEST(pd.offset(keys[i].x(), keys[i].y()) == i);
+  }
+
+  // Indexing half of them again invalidates the others
+  keys.erase(keys.begin() + std::ptrdiff_t(keys.size() / 2), keys.end());
+  pd.build_fast_indexing(keys);
+  uint32_t n_valid = 0;
+  for (uint32_t x = 0; x < lx; ++x) {
+    for (uint32_t y = 0; y < ly; ++y) {
+      n_valid += pd.is_valid_corner(x, y) ? 1u : 0u;
+    }
+  }
+  BOOST_TEST(n_valid == keys.size());
+  for (uint32_t i = 0; i < keys.size(); ++i) {
+    BOOST_TEST(pd.offset(keys[i].x(), keys[i].y()) == i);
+  }
+}
@@ -1,6 +1,7 @@
 #define BOOST_TEST_MODULE test_quadtree
 #include "quadtree.hpp"
 #include "quadtree_leaf_locator.hpp"
+#include <algorithm>
 #include <bit>
 #include <boost/test/included/unit_test.hpp>
 #include <cmath>
@@ -527,4 +528,205 @@ BOOST_AUTO_TEST_CASE(Predictable_8x8_build_then_grade_changes)
     }
 }
 
+BOOST_AUTO_TEST_CASE(Linear_locator_on_non_square_grid)
+{
+  constexpr uint32_t lx = 32, ly = 16;
+  auto metric = [](uint32_t x, uint32_t y, uint32_t s) {
+    return double((x * 7 + y * 3) % 11 + s);  // irregular
+  };
+  Quadtree qt(std::max(lx, ly), 120, metric);
+  qt.build();
+  qt.grade();
+
+  QuadtreeLeafLocator qt_locator;
+  qt_locator.build(lx, ly, qt.nodes());
+
+  // Leaves inside the grid are listed in Morton order
+  const auto leaves = qt_locator.leaves();
+  for (std::size_t k = 0; k < leaves.size(); ++k) {
+    BOOST_TEST(leaves[k].x + leaves[k].size <= lx);
+    BOOST_TEST(leaves[k].y + leaves[k].size <= ly);
+    if (k > 0) {
+      BOOST_TEST(
+        morton_code(leaves[k - 1].x, leaves[k - 1].y) <
+        morton_code(leaves[k].x, leaves[k].y));
+    }
+  }
+
+  for (uint32_t px = 0; px < lx; ++px) {
+    for (uint32_t py = 0; py < ly; ++py) {
+      auto lf = qt_locator.locate(px + 0.5, py + 0.5);
+      BOOST_TEST(px >= lf.x);
+      BOOST_TEST(px < lf.x + lf.size);
+      BOOST_TEST(py >= lf.y);
+      BOOST_TEST(py < lf.y + lf.size);
+    }
+  }
+
+  // Points on or beyond the top-right boundary are clamped to the grid
+  const auto corner = qt_locator.locate(double(lx), double(ly));
+  const auto inside = qt_locator.locate(lx - 0.5, ly - 0.5);
+  BOOST_TEST((corner == inside));
+}
+
+BOOST_AUTO_TEST_CASE(Parallel_build_meets_leaf_budget_and_tiles)
+{
+  constexpr uint32_t root = 128;
+  auto metric = [](uint32_t x, uint32_t y, uint32_t s) {
+    return double((x * 13 + y * 5) % 17) * s;  // irregular
+  };
+  for (const std::size_t target : {1u, 2u, 50u, 1000u, 100000u}) {
+    Quadtree qt(root, target, metric);
+    qt.build_parallel();
+    const std::size_t expected = std::min<std::size_t>(
+      root * root,
+      std::max<std::size_t>(target, 1));
+    BOOST_TEST(qt.num_leaves() >= expected);
+    BOOST_TEST(qt.num_leaves() <= expected + 2);
+    BOOST_TEST(qt.leaves().size() == qt.num_leaves());
+
+    std::vector<uint8_t> mask(root * root, 0);
+    for (auto [x, y, sz] : qt.leaves())
+      for (uint32_t yy = y; yy < y + sz; ++yy)
+        for (uint32_t xx = x; xx < x + sz; ++xx)
+          ++mask[yy * root + xx];
+    for (uint8_t v : mask)
+      BOOST_TEST(v == 1u);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Parallel_grade_matches_serial_grade)
+{
+  constexpr uint32_t root = 64;
+  auto metric = [](uint32_t x, uint32_t y, uint32_t) -> uint32_t {
+    return (x + y < 6u) ? 1u : 0u;  // deep refinement near (0, 0)
+  };
+  Quadtree serial(root, 200, metric);
+  Quadtree parallel(root, 200, metric);
+  serial.build();
+  parallel.build();
+  serial.grade();
+  parallel.grade_parallel();
+
+  auto cmp = [](const auto &a, const auto &b) {
+    if (a.y != b.y)
+      return a.y < b.y;
+    if (a.x != b.x)
+      return a.x < b.x;
+    return a.size < b.size;
+  };
+  auto a = serial.leaves();
+  auto b = parallel.leaves();
+  std::sort(a.begin(), a.end(), cmp);
+  std::sort(b.begin(), b.end(), cmp);
+  BOOST_TEST_REQUIRE(a.size() == b.size());
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    BOOST_TEST(a[i].x == b[i].x);
+    BOOST_TEST(a[i].y == b[i].y);
+    BOOST_TEST(a[i].size == b[i].size);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Update_without_changes_keeps_tree)
+{
+  constexpr uint32_t root = 64;
+  auto metric = [](uint32_t x, uint32_t y, uint32_t s) {
+    return double((x * 13 + y * 5) % 17) * s;
+  };
+  Quadtree qt(root, 300, metric);
+  qt.build();
+  qt.grade();
+  const auto before = qt.leaves();
+  const auto report = qt.update([](uint32_t, uint32_t, uint32_t) {
+    return false;
+  });
+  BOOST_TEST(report.added.empty());
+  BOOST_TEST(report.removed.empty());
+  BOOST_TEST(report.evaluated.empty());
+  const auto after = qt.leaves();
+  BOOST_TEST_REQUIRE(before.size() == after.size());
+  for (std::size_t i = 0; i < before.size(); ++i) {
+    BOOST_TEST(before[i].x == after[i].x);
+    BOOST_TEST(before[i].y == after[i].y);
+    BOOST_TEST(before[i].size == after[i].size);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Update_follows_local_change_and_reports_leaf_changes)
+{
+  constexpr uint32_t root = 128;
+  std::vector<double> field(root * root);
+  for (uint32_t i = 0; i < root * root; ++i)
+    field[i] = double((i * 2654435761u) % 1000u) / 1000.0;
+
+  // Range of the field over a block, as the density metric
+  auto metric = [&field](uint32_t x, uint32_t y, uint32_t s) {
+    double lo = field[x * root + y], hi = lo;
+    for (uint32_t i = x; i < x + s; ++i)
+      for (uint32_t j = y; j < y + s; ++j) {
+        lo = std::min(lo, field[i * root + j]);
+        hi = std::max(hi, field[i * root + j]);
+      }
+    return hi - lo;
+  };
+  Quadtree qt(root, 400, metric);
+  qt.build();
+  qt.grade();
+  const auto before = qt.leaves();
+
+  // Flatten the field in one corner, where leaves must merge
+  constexpr uint32_t region = 48;
+  for (uint32_t i = 0; i < region; ++i)
+    for (uint32_t j = 0; j < region; ++j)
+      field[i * root + j] = 0.5;
+  const auto report = qt.update([](uint32_t x, uint32_t y, uint32_t) {
+    return x < region && y < region;
+  });
+  const auto after = qt.leaves();
+  BOOST_TEST(!report.removed.empty());
+
+  // Leaves before, minus the removed, plus the added, give the leaves after
+  auto key = [](const auto &l) {
+    return (uint64_t(l.x) << 40) | (uint64_t(l.y) << 20) | l.size;
+  };
+  std::vector<uint64_t> expected, actual;
+  for (const auto &l : before)
+    expected.push_back(key(l));
+  for (const auto &l : report.added)
+    expected.push_back(key(l));
+  std::sort(expected.begin(), expected.end());
+  for (const auto &l : report.removed) {
+    const auto it =
+      std::lower_bound(expected.begin(), expected.end(), key(l));
+    BOOST_TEST_REQUIRE((it != expected.end() && *it == key(l)));
+    expected.erase(it);
+  }
+  for (const auto &l : after)
+    actual.push_back(key(l));
+  std::sort(actual.begin(), actual.end());
+  BOOST_TEST((actual == expected));
+
+  // The leaves tile the root, stay graded, and the flat corner is coarse
+  std::vector<uint8_t> mask(root * root, 0);
+  std::vector<uint32_t> size_at(root * root, 0);
+  for (auto [x, y, sz] : after)
+    for (uint32_t yy = y; yy < y + sz; ++yy)
+      for (uint32_t xx = x; xx < x + sz; ++xx) {
+        ++mask[yy * root + xx];
+        size_at[yy * root + xx] = sz;
+      }
+  for (uint8_t v : mask)
+    BOOST_TEST(v == 1u);
+  for (uint32_t yy = 0; yy < root; ++yy)
+    for (uint32_t xx = 0; xx + 1 < root; ++xx) {
+      const uint32_t a = size_at[yy * root + xx];
+      const uint32_t b = size_at[yy * root + xx + 1];
+      BOOST_TEST(std::max(a, b) <= 2 * std::min(a, b));
+      const uint32_t c = size_at[xx * root + yy];
+      const uint32_t d = size_at[(xx + 1) * root + yy];
+      BOOST_TEST(std::max(c, d) <= 2 * std::min(c, d));
+    }
+  BOOST_TEST(size_at[0] >= 8u);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,130 @@
+#define BOOST_TEST_MODULE test_spectral_stage
+#include "constants.hpp"
+#include "spectral_stage.hpp"
+#include <boost/test/included/unit_test.hpp>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace
+{
+struct Spectrum {
+  unsigned int lx, ly;
+  FTReal2d rho_ft, fluxx, fluxy;
+
+  Spectrum(const unsigned int x, const unsigned int y) : lx(x), ly(y)
+  {
+    rho_ft.allocate(lx, ly);
+    fluxx.allocate(lx, ly);
+    fluxy.allocate(lx, ly);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> coeff(-1.0, 1.0);
+    for (unsigned int i = 0; i < lx; ++i) {
+      for (unsigned int j = 0; j < ly; ++j) {
+        rho_ft(i, j) = coeff(rng);
+        fluxx(i, j) = coeff(rng);
+        fluxy(i, j) = coeff(rng);
+      }
+    }
+  }
+
+  ~Spectrum()
+  {
+    rho_ft.free();
+    fluxx.free();
+    fluxy.free();
+  }
+};
+
+// Blurred coefficient and flux coefficients as computed element by element
+// with the formulas from the FFTW documentation
+double reference_blur(
+  double rho,
+  unsigned int i,
+  unsigned int j,
+  unsigned int lx,
+  unsigned int ly,
+  double bw)
+{
+  const double prefactor = -0.5 * bw * bw * pi * pi;
+  const double di = i, dj = j, dlx = lx, dly = ly;
+  return rho * std::exp(prefactor * (di * di / (dlx * dlx))) *
+         std::exp(prefactor * (dj * dj / (dly * dly))) / (4.0 * dlx * dly);
+}
+
+double reference_fluxx(
+  const FTReal2d &blurred,
+  unsigned int i,
+  unsigned int j,
+  unsigned int lx,
+  unsigned int ly)
+{
+  const double di = i, dlx = lx, dly = ly;
+  const double denom =
+    pi * ((di + 1) / dlx + (j / (di + 1)) * (j / dly) * (dlx / dly));
+  return -blurred(i + 1, j) / denom;
+}
+
+double reference_fluxy(
+  const FTReal2d &blurred,
+  unsigned int i,
+  unsigned int j,
+  unsigned int lx,
+  unsigned int ly)
+{
+  const double di = i, dlx = lx, dly = ly;
+  const double denom =
+    pi * ((di / (j + 1)) * (di / dlx) * (dly / dlx) + (j + 1) / dly);
+  return -blurred(i, j + 1) / denom;
+}
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(matches_elementwise_blur_and_flux)
+{
+  Spectrum s(16, 8);
+  std::vector<double> rho(s.lx * s.ly);
+  for (unsigned int i = 0; i < s.lx; ++i) {
+    for (unsigned int j = 0; j < s.ly; ++j) {
+      rho[i * s.ly + j] = s.rho_ft(i, j);
+    }
+  }
+  SpectralStage stage;
+  const double bw = 2.5;
+  stage.blur_and_compute_flux(s.rho_ft, s.fluxx, s.fluxy, s.lx, s.ly, bw);
+  for (unsigned int i = 0; i < s.lx; ++i) {
+    for (unsigned int j = 0; j < s.ly; ++j) {
+      const double expected =
+        reference_blur(rho[i * s.ly + j], i, j, s.lx, s.ly, bw);
+      BOOST_TEST(std::abs(s.rho_ft(i, j) - expected) <= 1e-15);
+    }
+  }
+  for (unsigned int i = 0; i < s.lx; ++i) {
+    for (unsigned int j = 0; j < s.ly; ++j) {
+      const double fx = (i + 1 < s.lx)
+                          ? reference_fluxx(s.rho_ft, i, j, s.lx, s.ly)
+                          : 0.0;
+      const double fy = (j + 1 < s.ly)
+                          ? reference_fluxy(s.rho_ft, i, j, s.lx, s.ly)
+                          : 0.0;
+      BOOST_TEST(std::abs(s.fluxx(i, j) - fx) <= 1e-14);
+      BOOST_TEST(std::abs(s.fluxy(i, j) - fy) <= 1e-14);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(tables_follow_grid_size_changes)
+{
+  SpectralStage stage;
+  for (const unsigned int lx : {8u, 4u, 8u}) {
+    Spectrum s(lx, 4);
+    const double rho_01 = s.rho_ft(0, 1);
+    stage.blur_and_compute_flux(s.rho_ft, s.fluxx, s.fluxy, s.lx, s.ly, 0.0);
+
+    // Without blur, only the normalisation is applied
+    BOOST_TEST(
+      std::abs(s.rho_ft(0, 1) - rho_01 / (4.0 * lx * s.ly)) <= 1e-15);
+    BOOST_TEST(
+      std::abs(s.fluxy(0, 0) - reference_fluxy(s.rho_ft, 0, 0, lx, s.ly)) <=
+      1e-14);
+  }
+}
@@ -503,6 +503,19 @@ static void run_case(
       BOOST_CHECK(triangle_vertices_within_leaf_boundary<TriT>(qt, L, T));
     }
 
+    // leaf_triangles() must give exactly the triangles of each leaf
+    size_t n_leaf_triangles = 0;
+    for (const auto &L : qt.leaves()) {
+      const auto leaf_Ts = tri.leaf_triangles(L.x, L.y);
+      BOOST_CHECK_EQUAL(
+        leaf_Ts.size(),
+        static_cast<size_t>(2 + qt.count_midpoints(L)));
+      for (const auto &T : leaf_Ts)
+        BOOST_CHECK(triangle_vertices_within_leaf_boundary<TriT>(qt, L, T));
+      n_leaf_triangles += leaf_Ts.size();
+    }
+    BOOST_CHECK_EQUAL(n_leaf_triangles, Ts.size());
+
     // Locate() correctness on deterministic sets
     auto try_points = [&](const std::vector<Point> &P) {
       for (const auto &p : P) {
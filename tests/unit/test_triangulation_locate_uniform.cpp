@@ -2,12 +2,14 @@
 #include "cgal_typedef.hpp"
 #include "quadtree_corner.hpp"
 #include "round_point.hpp"
+#include "threading.hpp"
 #include "triangulation.hpp"
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Kernel/global_functions_2.h>
 #include <CGAL/number_utils.h>
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <boost/test/included/unit_test.hpp>
 #include <cmath>
 #include <cstdint>
@@ -367,3 +369,103 @@ BOOST_AUTO_TEST_CASE(Flip_Is_Detected)
     MirrorXProjection(),
     /*expect_ok=*/false);
 }
+
+BOOST_AUTO_TEST_CASE(Build_Is_Independent_Of_Thread_Count)
+{
+  // Triangles must come out in leaf order whichever way the leaves are
+  // split among threads
+  const UniformQuadtreeLocator qt;
+  const WavyProjection proj(0.05);
+  std::vector<std::array<QuadtreeCorner, 3>> reference;
+  for (const unsigned int threads : {1u, 3u, 8u}) {
+    set_n_threads(threads);
+    Triangulation<UniformQuadtreeLocator, WavyProjection> tri;
+    BOOST_REQUIRE(tri.build(&qt, &proj));
+    std::vector<std::array<QuadtreeCorner, 3>> vertices;
+    for (const auto &t : tri.triangles())
+      vertices.push_back(t.vertices);
+    if (reference.empty())
+      reference = vertices;
+    BOOST_TEST((vertices == reference));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Transform_Matches_Barycentric_Interpolation)
+{
+  const UniformQuadtreeLocator qt;
+  const WavyProjection proj(0.05);
+  Triangulation<UniformQuadtreeLocator, WavyProjection> tri;
+  BOOST_REQUIRE(tri.build(&qt, &proj));
+
+  std::vector<Point> batch = sample_points(1000);
+  const std::vector<Point> pts = batch;
+  tri.transform(batch);
+  uint32_t last_triangle_idx = UINT32_MAX;
+  for (size_t i = 0; i < pts.size(); ++i) {
+    const auto &v = tri.locate(pts[i])->vertices;
+    const auto [a, b, c] =
+      CGAL::Barycentric_coordinates::triangle_coordinates_in_tuple_2<Point>(
+        v[0],
+        v[1],
+        v[2],
+        pts[i]);
+    const Point p0 = proj.get(v[0].x(), v[0].y());
+    const Point p1 = proj.get(v[1].x(), v[1].y());
+    const Point p2 = proj.get(v[2].x(), v[2].y());
+    const double x = a * p0.x() + b * p1.x() + c * p2.x();
+    const double y = a * p0.y() + b * p1.y() + c * p2.y();
+
+    const Point single = tri.transform(pts[i], last_triangle_idx);
+    BOOST_TEST(std::abs(single.x() - x) <= 1e-12);
+    BOOST_TEST(std::abs(single.y() - y) <= 1e-12);
+
+    // The batch must give exactly the same points in the original order
+    BOOST_TEST(
+      std::bit_cast<uint64_t>(single.x()) ==
+      std::bit_cast<uint64_t>(batch[i].x()));
+    BOOST_TEST(
+      std::bit_cast<uint64_t>(single.y()) ==
+      std::bit_cast<uint64_t>(batch[i].y()));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Locate_Points_On_And_Near_Edges)
+{
+  const UniformQuadtreeLocator qt;
+  const ShearXProjection proj(0.13);
+  using TriT = Triangulation<UniformQuadtreeLocator, ShearXProjection>;
+  TriT tri;
+  BOOST_REQUIRE(tri.build(&qt, &proj));
+  const auto &Ts = tri.triangles();
+
+  // Grid corners, points on cell edges and diagonals, and points within a
+  // few ulps of them, where the floating-point test cannot decide
+  std::vector<Point> pts;
+  for (uint32_t y = 0; y < GRID_H; ++y) {
+    for (uint32_t x = 0; x < GRID_W; ++x) {
+      const double xd = x, yd = y;
+      for (const double t : {0.0, 0.25, 0.5}) {
+        pts.emplace_back(xd + t, yd);
+        pts.emplace_back(xd, yd + t);
+        pts.emplace_back(xd + t, yd + t);
+        pts.emplace_back(xd + t, yd + 1.0 - t);
+        pts.emplace_back(xd + t, std::nextafter(yd + t, 0.0));
+        pts.emplace_back(std::nextafter(xd + t, 9.0), yd + 1.0 - t);
+      }
+    }
+  }
+
+  for (const auto &p : pts) {
+    uint32_t last_triangle_idx = UINT32_MAX;
+    const auto it = tri.locate(p, last_triangle_idx);
+    BOOST_REQUIRE(it != Ts.end());
+
+    // Must be the first triangle of the leaf that contains p exactly
+    const auto leaf = qt.locate(p);
+    const auto first = std::find_if(Ts.begin(), Ts.end(), [&](const auto &T) {
+      return triangle_in_leaf<TriT>(T, leaf.x, leaf.y) &&
+             triangle_contains<TriT>(T, p);
+    });
+    BOOST_TEST((it == first));
+  }
+}
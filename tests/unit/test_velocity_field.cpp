@@ -0,0 +1,151 @@
+#define BOOST_TEST_MODULE test_velocity_field
+#include "interpolate_bilinearly.hpp"
+#include "velocity_field.hpp"
+#include <boost/test/included/unit_test.hpp>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace
+{
+struct Grids {
+  unsigned int lx, ly;
+  FTReal2d fluxx, fluxy, rho_init, rho_ft;
+
+  Grids(const unsigned int x, const unsigned int y) : lx(x), ly(y)
+  {
+    fluxx.allocate(lx, ly);
+    fluxy.allocate(lx, ly);
+    rho_init.allocate(lx, ly);
+    rho_ft.allocate(lx, ly);
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> flux(-1.0, 1.0);
+    std::uniform_real_distribution<double> rho(0.5, 1.5);
+    for (unsigned int i = 0; i < lx; ++i) {
+      for (unsigned int j = 0; j < ly; ++j) {
+        fluxx(i, j) = flux(rng);
+        fluxy(i, j) = flux(rng);
+        rho_init(i, j) = rho(rng);
+        rho_ft(i, j) = 0.0;
+      }
+    }
+    rho_ft(0, 0) = 1.0;
+  }
+
+  ~Grids()
+  {
+    fluxx.free();
+    fluxy.free();
+    rho_init.free();
+    rho_ft.free();
+  }
+
+  // Velocity as interpolated by the scalar reference implementation
+  double reference(double x, double y, double t, char direction) const
+  {
+    auto cal_velocity = [&](unsigned int i, unsigned int j, char d) {
+      const double r =
+        rho_ft(0, 0) + (1.0 - t) * (rho_init(i, j) - rho_ft(0, 0));
+      return (d == 'x') ? (-fluxx(i, j) / r) : (-fluxy(i, j) / r);
+    };
+    return interpolate_bilinearly(x, y, cal_velocity, direction, lx, ly);
+  }
+};
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(matches_scalar_interpolation_everywhere)
+{
+  const Grids g(8, 4);
+  VelocityField vf;
+  vf.build(g.fluxx, g.fluxy, g.rho_init, g.rho_ft, g.lx, g.ly);
+
+  // Sample on a lattice that includes the domain boundary, the cell centres
+  // and the cell edges
+  for (const double t : {0.0, 0.3, 1.0}) {
+    for (unsigned int sx = 0; sx <= 4 * g.lx; ++sx) {
+      for (unsigned int sy = 0; sy <= 4 * g.ly; ++sy) {
+        const double x = 0.25 * sx;
+        const double y = 0.25 * sy;
+        const Vector v = vf.velocity(x, y, t);
+        BOOST_TEST(std::abs(v.x() - g.reference(x, y, t, 'x')) <= 1e-12);
+        BOOST_TEST(std::abs(v.y() - g.reference(x, y, t, 'y')) <= 1e-12);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(normal_velocity_vanishes_on_boundary)
+{
+  const Grids g(4, 4);
+  VelocityField vf;
+  vf.build(g.fluxx, g.fluxy, g.rho_init, g.rho_ft, g.lx, g.ly);
+  for (const double s : {0.0, 0.7, 2.5, 4.0}) {
+    BOOST_TEST(std::abs(vf.velocity(0.0, s, 0.5).x()) <= 1e-15);
+    BOOST_TEST(std::abs(vf.velocity(4.0, s, 0.5).x()) <= 1e-15);
+    BOOST_TEST(std::abs(vf.velocity(s, 0.0, 0.5).y()) <= 1e-15);
+    BOOST_TEST(std::abs(vf.velocity(s, 4.0, 0.5).y()) <= 1e-15);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(batch_matches_scalar_and_flags_points_outside_domain)
+{
+  const Grids g(8, 8);
+  VelocityField vf;
+  vf.build(g.fluxx, g.fluxy, g.rho_init, g.rho_ft, g.lx, g.ly);
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const std::vector<double> x = {0.0, 3.3, 8.0, -0.1, 4.0, 8.5, nan};
+  const std::vector<double> y = {0.0, 7.9, 2.2, 4.0, -1e-9, 1.0, 4.0};
+  const size_t n = x.size();
+  std::vector<double> vx(n), vy(n);
+  std::vector<unsigned char> in_domain(n);
+  vf.velocities(
+    x.data(),
+    y.data(),
+    n,
+    0.4,
+    vx.data(),
+    vy.data(),
+    in_domain.data());
+  for (size_t k = 0; k < 3; ++k) {
+    const Vector v = vf.velocity(x[k], y[k], 0.4);
+    BOOST_TEST(in_domain[k] == 1);
+    BOOST_TEST(std::abs(vx[k] - v.x()) <= 1e-15);
+    BOOST_TEST(std::abs(vy[k] - v.y()) <= 1e-15);
+  }
+  for (size_t k = 3; k < n; ++k) {
+    BOOST_TEST(in_domain[k] == 0);
+    BOOST_TEST(std::isfinite(vx[k]));
+    BOOST_TEST(std::isfinite(vy[k]));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(single_precision_grids_match_double_precision)
+{
+  const Grids g(8, 4);
+  FTReal2df fluxx, fluxy, rho_ft;
+  fluxx.allocate(g.lx, g.ly);
+  fluxy.allocate(g.lx, g.ly);
+  rho_ft.allocate(g.lx, g.ly);
+  for (unsigned int i = 0; i < g.lx; ++i) {
+    for (unsigned int j = 0; j < g.ly; ++j) {
+      fluxx(i, j) = static_cast<float>(g.fluxx(i, j));
+      fluxy(i, j) = static_cast<float>(g.fluxy(i, j));
+      rho_ft(i, j) = static_cast<float>(g.rho_ft(i, j));
+    }
+  }
+  VelocityField vf, vf_f;
+  vf.build(g.fluxx, g.fluxy, g.rho_init, g.rho_ft, g.lx, g.ly);
+  vf_f.build(fluxx, fluxy, g.rho_init, rho_ft, g.lx, g.ly);
+  for (const double x : {0.0, 1.3, 4.5, 8.0}) {
+    for (const double y : {0.0, 0.7, 2.2, 4.0}) {
+      const Vector v = vf.velocity(x, y, 0.5);
+      const Vector v_f = vf_f.velocity(x, y, 0.5);
+      BOOST_TEST(std::abs(v.x() - v_f.x()) <= 1e-6);
+      BOOST_TEST(std::abs(v.y() - v_f.y()) <= 1e-6);
+    }
+  }
+  fluxx.free();
+  fluxy.free();
+  rho_ft.free();
+}